@@ -0,0 +1,93 @@
+#include <stddef.h>
+
+#include "harness.h"
+#include "list.h"
+#include "queue.h"
+#include "bottom_up_sort.h"
+
+/* Merge two null-terminated sorted runs, taking @a first on ties so that the
+ * sort is stable
+ */
+static struct list_head *merge(struct list_head *a,
+                               struct list_head *b,
+                               bool descend)
+{
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        int c = q_compare(list_entry(a, element_t, list),
+                          list_entry(b, element_t, list));
+        if ((descend ? -c : c) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/*
+ * Bottom-up merge sort without recursion.  bin[k] holds a sorted run of 2^k
+ * elements or nothing; each input element is carried up the bins like a
+ * binary counter increment, merging the runs it meets on the way.  The runs
+ * are null-terminated singly-linked lists as in list_sort(), and the prev
+ * links are restored by one final pass.
+ */
+void bottom_up_sort(struct list_head *head, bool descend)
+{
+    struct list_head *bin[64] = {NULL}, *list, *carry;
+    int max = 0;
+
+    if (!head || head->next == head->prev) /* Zero or one elements */
+        return;
+
+    /* Convert to a null-terminated singly-linked list. */
+    head->prev->next = NULL;
+    list = head->next;
+
+    while (list) {
+        int k;
+        carry = list;
+        list = list->next;
+        carry->next = NULL;
+        /* bin[k] holds older elements, keep it first for stability */
+        for (k = 0; bin[k]; k++) {
+            carry = merge(bin[k], carry, descend);
+            bin[k] = NULL;
+        }
+        bin[k] = carry;
+        if (k > max)
+            max = k;
+    }
+
+    /* Merge the remaining runs, from the newest to the oldest */
+    carry = NULL;
+    for (int k = 0; k <= max; k++) {
+        if (!bin[k])
+            continue;
+        carry = carry ? merge(bin[k], carry, descend)
+                      : bin[k];
+    }
+
+    /* Restore the prev links and close the circle */
+    struct list_head *prev = head;
+    for (list = carry; list; list = list->next) {
+        prev->next = list;
+        list->prev = prev;
+        prev = list;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
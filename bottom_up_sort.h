@@ -0,0 +1,6 @@
+#ifndef LAB0_BOTTOM_UP_SORT_H
+#define LAB0_BOTTOM_UP_SORT_H
+
+void bottom_up_sort(struct list_head *head, bool descend);
+
+#endif /* LAB0_BOTTOM_UP_SORT_H */
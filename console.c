@@ -438,7 +438,10 @@ void init_cmd()
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
-    add_param("sort", &sort, "Sort type: merge sort/linux list sort", NULL);
+    add_param("sort", &sort,
+              "Sort type: merge sort/linux list sort/radix sort/bottom-up "
+              "merge sort/parallel sort/timsort",
+              NULL);
 
     init_in();
     init_time(&last_time);
@@ -1,11 +1,13 @@
 /* Test support code */
 
+#include <math.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -30,24 +32,90 @@
 
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
- */
+/* Header placed in front of every allocated block */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
     size_t payload_size;
-    size_t magic_header; /* Marker to see if block seems legitimate */
+    uint32_t magic_header; /* Marker to see if block seems legitimate */
+    uint32_t site;         /* Call site in memory profiling mode, or 0 */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
+/* Keep the addresses of the allocated blocks in an open addressing hash
+ * table with linear probing, so that proving a block is live before freeing
+ * it takes constant time however many blocks there are.  The table doubles
+ * once it is three quarters full and never shrinks.
+ */
+#define LIVE_MIN_BITS 10
+
+static block_element_t **live_table = NULL;
+static unsigned live_bits = 0;
+
+/* Freed blocks first wait in a quarantine, so that a block is not handed out
+ * again while dangling pointers to it are likely still around.  Small blocks
+ * are then kept on per size class stacks for reuse, the others go back to the
+ * system.  A freed block is poisoned over its whole capacity, and must still
+ * hold that poison when it is reused or returned, or it was written after
+ * being freed.  As it was verified to be filled with FILLCHAR, a reused block
+ * needs no filling for malloc.
+ */
+#define QUARANTINE_BLOCKS 1024
+#define QUARANTINE_BYTES (4 * 1024 * 1024)
+
+#define CACHE_CLASS_SIZE 16
+#define CACHE_CLASSES 32
+#define CACHE_BYTES (16 * 1024 * 1024)
+
+/* Size classes are multiples of CACHE_CLASS_SIZE up to this payload */
+#define CACHE_MAX_SIZE (CACHE_CLASS_SIZE * CACHE_CLASSES)
+
+static block_element_t *quarantine[QUARANTINE_BLOCKS];
+static size_t quarantine_first = 0, quarantine_count = 0;
+static size_t quarantine_bytes = 0;
+
+/**
+ * cache_class_t - Stack of freed blocks of one size class
+ * @blocks: the blocks, the most recently freed on top
+ * @count: number of blocks in @blocks
+ * @room: number of blocks @blocks has room for
+ */
+typedef struct {
+    block_element_t **blocks;
+    size_t count, room;
+} cache_class_t;
+
+static cache_class_t cache[CACHE_CLASSES];
+static size_t cache_bytes = 0;
 static size_t allocated_count = 0;
+static size_t suballocated_count = 0;
+
+/* In memory profiling mode, the blocks allocated from each call site are
+ * counted in an open addressing hash table keyed on the return address.
+ * Slot 0 is never used, so that a block header can tell it was allocated
+ * with the mode off.
+ */
+int mem_profile = 0;
+
+static mem_site_t mem_site_table[MEM_SITES];
+
+/* Memory statistics, see mem_stats_t */
+static size_t allocated_bytes = 0, peak_bytes = 0;
+static size_t alloc_total = 0, free_total = 0;
+static size_t size_hist[MEM_HIST_BUCKETS];
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
-static bool cautious_mode = true;
+/* Seed of the malloc failures, picked by fail_reset() if 0 */
+int malloc_seed = 0;
+
+/* Rather than drawing a random number on every allocation, the number of
+ * allocations to let through before the next failure is drawn once from the
+ * geometric distribution of parameter fail_probability, and counted down.
+ */
+static uint64_t fail_state;
+static uint64_t fail_skip = UINT64_MAX;
+
 static bool noallocate_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
@@ -63,19 +131,121 @@ static bool time_limited = false;
 typedef enum {
     TEST_MALLOC,
     TEST_CALLOC,
+    TEST_REALLOC,
 } alloc_t;
 
 /* Internal functions */
 
+/* Draw the number of allocations which succeed before the next failure */
+static void fail_draw(void)
+{
+    if (fail_probability <= 0) {
+        fail_skip = UINT64_MAX;
+        return;
+    }
+    if (fail_probability >= 100) {
+        fail_skip = 0;
+        return;
+    }
+
+    /* xorshift64*, then a uniform variate in (0, 1] */
+    fail_state ^= fail_state >> 12;
+    fail_state ^= fail_state << 25;
+    fail_state ^= fail_state >> 27;
+    uint64_t x = fail_state * 0x2545F4914F6CDD1DULL;
+    double u = ((x >> 11) + 1) * 0x1.0p-53;
+    double skip = floor(log(u) / log1p(-0.01 * fail_probability));
+    fail_skip = skip < (double) UINT64_MAX ? (uint64_t) skip : UINT64_MAX;
+}
+
+void fail_reset(void)
+{
+    if (!malloc_seed)
+        malloc_seed = (int) ((time(NULL) ^ getpid()) & 0x7fffffff) | 1;
+
+    /* splitmix64 of the seed, which never leaves the state zero */
+    uint64_t z = (uint64_t) malloc_seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    fail_state = (z ^ (z >> 31)) | 1;
+    fail_draw();
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    if (fail_skip) {
+        fail_skip--;
+        return false;
+    }
+    fail_draw();
+    return true;
+}
+
+/* Home slot of block @b in the live table */
+static inline size_t live_slot(const block_element_t *b)
+{
+    /* Fibonacci hashing of the address, whose low bits are always zero */
+    return (((uintptr_t) b >> 4) * 0x9E3779B97F4A7C15ULL) >> (64 - live_bits);
+}
+
+/* Find the slot holding @b, or the empty slot where it would go */
+static size_t live_find(const block_element_t *b)
+{
+    size_t mask = ((size_t) 1 << live_bits) - 1;
+    size_t i = live_slot(b);
+    while (live_table[i] && live_table[i] != b)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Make room for one more block, false if the table could not grow */
+static bool live_reserve(void)
+{
+    size_t cap = live_table ? (size_t) 1 << live_bits : 0;
+    if ((allocated_count + 1) * 4 <= cap * 3)
+        return true;
+
+    block_element_t **old = live_table;
+    unsigned bits = live_bits ? live_bits + 1 : LIVE_MIN_BITS;
+    block_element_t **table = calloc((size_t) 1 << bits, sizeof(*table));
+    if (!table)
+        return false;
+    live_table = table;
+    live_bits = bits;
+    for (size_t i = 0; i < cap; i++) {
+        if (old[i])
+            live_table[live_find(old[i])] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+static inline bool live_has(const block_element_t *b)
+{
+    return live_table && live_table[live_find(b)];
+}
+
+/* Remove @b, which must be in the table, shifting back the blocks after it
+ * which would become unreachable from their home slots
+ */
+static void live_remove(const block_element_t *b)
+{
+    size_t mask = ((size_t) 1 << live_bits) - 1;
+    size_t hole = live_find(b);
+    for (size_t i = (hole + 1) & mask; live_table[i]; i = (i + 1) & mask) {
+        size_t home = live_slot(live_table[i]);
+        /* move it unless its home lies cyclically within (hole, i] */
+        if (hole < i ? home <= hole || home > i : home <= hole && home > i) {
+            live_table[hole] = live_table[i];
+            hole = i;
+        }
+    }
+    live_table[hole] = NULL;
 }
 
 /* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
+ * Signal error and return NULL if doesn't seem like legitimate block
  */
 static block_element_t *find_header(void *p)
 {
@@ -86,20 +256,12 @@ static block_element_t *find_header(void *p)
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
-        /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
-            report_event(MSG_ERROR,
-                         "Attempted to free unallocated block.  Address = %p",
-                         p);
-            error_occurred = true;
-        }
+    /* Make sure this is really an allocated block */
+    if (!live_has(b)) {
+        report_event(MSG_ERROR,
+                     "Attempted to free unallocated block.  Address = %p", p);
+        error_occurred = true;
+        return NULL;
     }
 
     if (b->magic_header != MAGICHEADER) {
@@ -122,12 +284,124 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
-static void *alloc(alloc_t alloc_type, size_t size)
+/* Payload a block for @size bytes is allocated with, rounded up to its size
+ * class if it has one
+ */
+static inline size_t block_capacity(size_t size)
+{
+    if (size > CACHE_MAX_SIZE)
+        return size;
+    size = size ? size : 1;
+    return (size + CACHE_CLASS_SIZE - 1) & ~(size_t) (CACHE_CLASS_SIZE - 1);
+}
+
+/* Size class of a block with a capacity of @cap bytes */
+static inline size_t cache_class(size_t cap)
+{
+    return cap / CACHE_CLASS_SIZE - 1;
+}
+
+/* Check that freed block @b was not touched since it was poisoned, reporting
+ * it otherwise.  Return whether it was intact.
+ */
+static bool poison_check(block_element_t *b)
+{
+    const unsigned char *p = b->payload;
+    size_t n = b->payload_size;
+    /* every byte equals the one after it, and the first is FILLCHAR */
+    if (b->magic_header == MAGICFREE && *find_footer(b) == MAGICFREE &&
+        (!n || (p[0] == FILLCHAR && !memcmp(p, p + 1, n - 1))))
+        return true;
+
+    report_event(MSG_ERROR,
+                 "Block with address %p was written after being freed",
+                 (void *) &b->payload);
+    error_occurred = true;
+    return false;
+}
+
+/* Pop a freed block with a capacity of @cap bytes, NULL if none.  Set
+ * @poisoned to whether it is still filled with FILLCHAR.
+ */
+static block_element_t *cache_get(size_t cap, bool *poisoned)
+{
+    if (cap > CACHE_MAX_SIZE)
+        return NULL;
+    cache_class_t *c = &cache[cache_class(cap)];
+    if (!c->count)
+        return NULL;
+    block_element_t *b = c->blocks[--c->count];
+    cache_bytes -= cap;
+    *poisoned = poison_check(b);
+    return b;
+}
+
+/* Keep @b, leaving the quarantine, for reuse if it has a size class and the
+ * cache has room, otherwise check it and return it to the system
+ */
+static void cache_put(block_element_t *b)
+{
+    size_t cap = b->payload_size;
+    if (cap <= CACHE_MAX_SIZE && cache_bytes + cap <= CACHE_BYTES) {
+        cache_class_t *c = &cache[cache_class(cap)];
+        if (c->count == c->room) {
+            size_t room = c->room ? 2 * c->room : 64;
+            block_element_t **blocks =
+                realloc(c->blocks, room * sizeof(*blocks));
+            if (blocks) {
+                c->blocks = blocks;
+                c->room = room;
+            }
+        }
+        if (c->count < c->room) {
+            c->blocks[c->count++] = b;
+            cache_bytes += cap;
+            return;
+        }
+    }
+    poison_check(b);
+    free(b);
+}
+
+/* Put freed block @b in quarantine, releasing the oldest ones past the
+ * limits
+ */
+static void quarantine_add(block_element_t *b)
+{
+    quarantine[(quarantine_first + quarantine_count++) % QUARANTINE_BLOCKS] =
+        b;
+    quarantine_bytes += b->payload_size;
+    while (quarantine_count == QUARANTINE_BLOCKS ||
+           (quarantine_count > 1 && quarantine_bytes > QUARANTINE_BYTES)) {
+        block_element_t *old = quarantine[quarantine_first];
+        quarantine_first = (quarantine_first + 1) % QUARANTINE_BLOCKS;
+        quarantine_count--;
+        quarantine_bytes -= old->payload_size;
+        cache_put(old);
+    }
+}
+
+/* Slot of call site @addr in the profile, 0 if the table is full */
+static uint32_t mem_site_of(const void *addr)
+{
+    uint32_t h = (uint32_t) (((uintptr_t) addr * 0x9E3779B97F4A7C15ULL) >> 32);
+    for (uint32_t n = 1; n < MEM_SITES; n++, h++) {
+        uint32_t i = h % (MEM_SITES - 1) + 1;
+        if (!mem_site_table[i].addr)
+            mem_site_table[i].addr = addr;
+        if (mem_site_table[i].addr == addr)
+            return i;
+    }
+    return 0;
+}
+
+static void *alloc(alloc_t alloc_type, size_t size, const void *site)
 {
     if (noallocate_mode) {
         char *msg_alloc_forbidden[] = {
             "Calls to malloc are disallowed",
             "Calls to calloc are disallowed",
+            "Calls to realloc are disallowed",
         };
         report_event(MSG_FATAL, "%s", msg_alloc_forbidden[alloc_type]);
         return NULL;
@@ -137,35 +411,49 @@ static void *alloc(alloc_t alloc_type, size_t size)
         char *msg_alloc_failure[] = {
             "Malloc returning NULL",
             "Calloc returning NULL",
+            "Realloc returning NULL",
         };
         report_event(MSG_WARN, "%s", msg_alloc_failure[alloc_type]);
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
-    if (!new_block) {
+    size_t cap = block_capacity(size);
+    bool poisoned = false;
+    block_element_t *new_block = cache_get(cap, &poisoned);
+    if (!new_block)
+        new_block = malloc(cap + sizeof(block_element_t) + sizeof(size_t));
+    if (!new_block || !live_reserve()) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->magic_header = MAGICHEADER;
+    new_block->site = 0;
+    if (mem_profile && (new_block->site = mem_site_of(site))) {
+        mem_site_table[new_block->site].blocks++;
+        mem_site_table[new_block->site].bytes += size;
+    }
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
-    memset(p, !alloc_type * FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
+    if (alloc_type == TEST_CALLOC)
+        memset(p, 0, size);
+    else if (!poisoned)
+        memset(p, FILLCHAR, size);
+    live_table[live_find(new_block)] = new_block;
     allocated_count++;
 
+    int bucket = 0;
+    while (size >> (bucket + 1))
+        bucket++;
+    size_hist[bucket]++;
+    alloc_total++;
+    allocated_bytes += size;
+    if (allocated_bytes > peak_bytes)
+        peak_bytes = allocated_bytes;
+
     return p;
 }
 
@@ -173,7 +461,12 @@ static void *alloc(alloc_t alloc_type, size_t size)
 
 void *test_malloc(size_t size)
 {
-    return alloc(TEST_MALLOC, size);
+    return alloc(TEST_MALLOC, size, __builtin_return_address(0));
+}
+
+void *test_malloc_at(size_t size, const void *site)
+{
+    return alloc(TEST_MALLOC, size, site);
 }
 
 // cppcheck-suppress unusedFunction
@@ -184,7 +477,7 @@ void *test_calloc(size_t nelem, size_t elsize)
      */
     if (!nelem || !elsize || nelem > SIZE_MAX / elsize)
         return NULL;
-    return alloc(TEST_CALLOC, nelem * elsize);
+    return alloc(TEST_CALLOC, nelem * elsize, __builtin_return_address(0));
 }
 
 void test_free(void *p)
@@ -197,7 +490,11 @@ void test_free(void *p)
     if (!p)
         return;
 
+    /* Leave alone a block which is not allocated, find_header() reported it */
     block_element_t *b = find_header(p);
+    if (!b)
+        return;
+
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -206,50 +503,148 @@ void test_free(void *p)
                      p);
         error_occurred = true;
     }
+    live_remove(b);
+    allocated_bytes -= b->payload_size;
+    if (b->site) {
+        mem_site_table[b->site].blocks--;
+        mem_site_table[b->site].bytes -= b->payload_size;
+    }
+
+    /* poison the whole capacity, which a freed block records as its size */
+    b->payload_size = block_capacity(b->payload_size);
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
+    quarantine_add(b);
+    allocated_count--;
+    free_total++;
+}
 
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
+// cppcheck-suppress unusedFunction
+void *test_realloc(void *p, size_t size)
+{
+    if (!p)
+        return alloc(TEST_MALLOC, size, __builtin_return_address(0));
+    if (!size) {
+        test_free(p);
+        return NULL;
+    }
 
-    free(b);
-    allocated_count--;
+    /* Always move the block, so that callers holding on to the old address
+     * are caught.  On failure the old block is left untouched.
+     */
+    block_element_t *b = find_header(p);
+    if (!b)
+        return NULL;
+    void *new = alloc(TEST_REALLOC, size, __builtin_return_address(0));
+    if (!new)
+        return NULL;
+    memcpy(new, p, b->payload_size < size ? b->payload_size : size);
+    test_free(p);
+    return new;
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = alloc(TEST_MALLOC, len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
     return memcpy(new, s, len);
 }
 
+// cppcheck-suppress unusedFunction
+bool test_suballoc(size_t n)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to malloc are disallowed");
+        return false;
+    }
+
+    if (fail_allocation()) {
+        report_event(MSG_WARN, "Malloc returning NULL");
+        return false;
+    }
+
+    suballocated_count += n;
+    return true;
+}
+
+// cppcheck-suppress unusedFunction
+void test_subfree(size_t n)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+
+    if (n > suballocated_count) {
+        report_event(MSG_ERROR,
+                     "Attempted to free %lu objects, but only %lu are "
+                     "allocated",
+                     n, suballocated_count);
+        error_occurred = true;
+        n = suballocated_count;
+    }
+    suballocated_count -= n;
+}
+
 size_t allocation_check()
 {
-    return allocated_count;
+    return allocated_count + suballocated_count;
 }
 
-/* Implementation of functions for testing */
+bool mem_drain(void)
+{
+    bool intact = true;
+    for (; quarantine_count; quarantine_count--) {
+        block_element_t *b = quarantine[quarantine_first];
+        quarantine_first = (quarantine_first + 1) % QUARANTINE_BLOCKS;
+        intact &= poison_check(b);
+        free(b);
+    }
+    quarantine_bytes = 0;
+
+    for (size_t i = 0; i < CACHE_CLASSES; i++) {
+        cache_class_t *c = &cache[i];
+        while (c->count) {
+            block_element_t *b = c->blocks[--c->count];
+            intact &= poison_check(b);
+            free(b);
+        }
+        free(c->blocks);
+        c->blocks = NULL;
+        c->room = 0;
+    }
+    cache_bytes = 0;
+    return intact;
+}
 
-/* Set/unset cautious mode.
- * In this mode, makes extra sure any block to be freed is currently allocated.
- */
-void set_cautious_mode(bool cautious)
+size_t mem_sites(mem_site_t *sites)
 {
-    cautious_mode = cautious;
+    size_t n = 0;
+    for (size_t i = 1; i < MEM_SITES; i++) {
+        if (mem_site_table[i].blocks)
+            sites[n++] = mem_site_table[i];
+    }
+    return n;
 }
 
+void mem_stats(mem_stats_t *stats)
+{
+    stats->blocks = allocated_count;
+    stats->objects = suballocated_count;
+    stats->bytes = allocated_bytes;
+    stats->peak_bytes = peak_bytes;
+    stats->allocs = alloc_total;
+    stats->frees = free_total;
+    memcpy(stats->hist, size_hist, sizeof(size_hist));
+}
+
+/* Implementation of functions for testing */
+
 /* Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
@@ -13,22 +13,90 @@
 void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
+void *test_realloc(void *p, size_t size);
 char *test_strdup(const char *s);
-/* FIXME: provide test_realloc as well */
+
+/* Same as test_malloc, but in memory profiling mode charge the block to call
+ * site @site rather than to the caller, for allocators built on test_malloc
+ * to attribute their blocks to their own callers.
+ */
+void *test_malloc_at(size_t size, const void *site);
+
+/* Account for objects carved out of blocks obtained from test_malloc, so they
+ * are still counted one by one.  test_suballoc() is subject to the same
+ * failure injection and restrictions as test_malloc.
+ */
+bool test_suballoc(size_t n);
+void test_subfree(size_t n);
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/* Report number of allocated blocks and objects */
 size_t allocation_check();
 
+/* Return to the system the freed blocks the harness keeps for reuse, and
+ * report those written after being freed.  Return whether none was.
+ */
+bool mem_drain(void);
+
+/* Number of buckets of the size histogram, bucket i counts the blocks of
+ * 2^i to 2^(i+1) - 1 bytes, bucket 0 those of 0 and 1 byte
+ */
+#define MEM_HIST_BUCKETS 64
+
+/**
+ * mem_stats_t - Statistics of the memory obtained through the harness
+ * @blocks: blocks currently allocated
+ * @objects: objects currently accounted for by test_suballoc()
+ * @bytes: bytes of payload currently allocated
+ * @peak_bytes: highest value @bytes ever reached
+ * @allocs: blocks allocated so far, reallocations included
+ * @frees: blocks freed so far, reallocations included
+ * @hist: blocks allocated so far by their size rounded down to a power of 2
+ */
+typedef struct {
+    size_t blocks, objects;
+    size_t bytes, peak_bytes;
+    size_t allocs, frees;
+    size_t hist[MEM_HIST_BUCKETS];
+} mem_stats_t;
+
+/* Fill @stats with the current memory statistics */
+void mem_stats(mem_stats_t *stats);
+
+/* Whether to record the call site of each allocation, 0 or 1 */
+extern int mem_profile;
+
+/* Number of call sites the profile tells apart, one less are usable */
+#define MEM_SITES 1024
+
+/**
+ * mem_site_t - Blocks allocated from a call site in memory profiling mode
+ * @addr: return address of the call to malloc, calloc, realloc or strdup
+ * @blocks: blocks allocated from there which are still live
+ * @bytes: bytes of payload of those blocks
+ */
+typedef struct {
+    const void *addr;
+    size_t blocks, bytes;
+} mem_site_t;
+
+/* Copy to @sites, which has room for MEM_SITES entries, the call sites with
+ * live blocks, and return their number
+ */
+size_t mem_sites(mem_site_t *sites);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
-/*
- * Set/unset cautious mode.
- * In this mode, makes extra sure any block to be freed is currently allocated.
+/* Seed of the malloc failures, 0 to have fail_reset() pick one */
+extern int malloc_seed;
+
+/* Restart the malloc failures from malloc_seed, to be called once
+ * fail_probability or malloc_seed changes.  The same seed and probability
+ * make the same allocations fail.
  */
-void set_cautious_mode(bool cautious);
+void fail_reset(void);
 
 /*
  * Set/unset restricted allocation mode.
@@ -57,6 +125,7 @@ void trigger_exception(char *msg);
 #define malloc test_malloc
 #define calloc test_calloc
 #define free test_free
+#define realloc test_realloc
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
@@ -0,0 +1,135 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "intern.h"
+
+/* Number of buckets of the table, which is never resized so that it does not
+ * show up among the blocks allocated through the harness
+ */
+#define INTERN_HASH_BITS 16
+
+/**
+ * intern_str_t - String held in the table
+ * @next: next string in the same bucket
+ * @refs: number of elements pointing at @s
+ * @len: length of @s, excluding the null terminator
+ * @hash: hash of @s, picking its bucket
+ * @s: the string
+ */
+typedef struct intern_str {
+    struct intern_str *next;
+    size_t refs;
+    size_t len;
+    uint32_t hash;
+    char s[];
+} intern_str_t;
+
+int intern_mode = 0;
+
+static intern_str_t *table[1 << INTERN_HASH_BITS];
+static size_t total_refs;
+
+/* FNV-1a hash of a string */
+static inline uint32_t intern_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline intern_str_t **intern_bucket(uint32_t hash)
+{
+    return &table[(hash ^ (hash >> INTERN_HASH_BITS)) &
+                  ((1 << INTERN_HASH_BITS) - 1)];
+}
+
+static intern_str_t *intern_lookup(const char *s, size_t len, uint32_t hash)
+{
+    intern_str_t *is = *intern_bucket(hash);
+    while (is && (is->hash != hash || is->len != len || memcmp(is->s, s, len)))
+        is = is->next;
+    return is;
+}
+
+static inline intern_str_t *intern_of(const char *p)
+{
+    return (intern_str_t *) (p - offsetof(intern_str_t, s));
+}
+
+static inline void intern_hold(const char *p)
+{
+    intern_of(p)->refs++;
+    total_refs++;
+}
+
+char *intern_get(const char *s, size_t len)
+{
+    uint32_t hash = intern_hash(s, len);
+    intern_str_t *is = intern_lookup(s, len, hash);
+    if (!is) {
+        if (!(is = malloc(sizeof(intern_str_t) + len + 1)))
+            return NULL;
+        intern_str_t **bucket = intern_bucket(hash);
+        memcpy(is->s, s, len);
+        is->s[len] = '\0';
+        is->len = len;
+        is->hash = hash;
+        is->refs = 0;
+        is->next = *bucket;
+        *bucket = is;
+    }
+    intern_hold(is->s);
+    return is->s;
+}
+
+char *intern_find(const char *s, size_t len)
+{
+    intern_str_t *is = intern_lookup(s, len, intern_hash(s, len));
+    return is ? is->s : NULL;
+}
+
+void intern_put_many(char **s, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        intern_put(intern_find(s[i], strlen(s[i])));
+}
+
+bool intern_get_many(char **s, size_t n)
+{
+    char *p = NULL;
+    for (size_t i = 0; i < n; i++) {
+        /* a batch often repeats the same string */
+        if (i && s[i] == s[i - 1]) {
+            intern_hold(p);
+        } else if (!(p = intern_get(s[i], strlen(s[i])))) {
+            intern_put_many(s, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+void intern_put(const char *p)
+{
+    intern_str_t *is = intern_of(p);
+    total_refs--;
+    if (--is->refs)
+        return;
+
+    intern_str_t **link = intern_bucket(is->hash);
+    while (*link != is)
+        link = &(*link)->next;
+    *link = is->next;
+    free(is);
+}
+
+size_t intern_refs(void)
+{
+    return total_refs;
+}
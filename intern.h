@@ -0,0 +1,43 @@
+#ifndef LAB0_INTERN_H
+#define LAB0_INTERN_H
+
+/* Table of reference counted strings shared by the queue elements.
+ *
+ * With interning turned on, an element inserted with a string which is
+ * already in the table points at the copy held there instead of storing its
+ * own, so a queue holding the same string a million times keeps a single
+ * copy of it.  The copies are obtained with test_malloc and released along
+ * with their last reference.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Whether new elements take their strings from the table, 0 or 1 */
+extern int intern_mode;
+
+/* Return the copy of @s, whose length is @len, held in the table, adding it
+ * if needed, and take a reference to it.  NULL for allocation failed.
+ */
+char *intern_get(const char *s, size_t len);
+
+/* Return the copy of @s held in the table without taking a reference, NULL
+ * if there is none
+ */
+char *intern_find(const char *s, size_t len);
+
+/* Take a reference to each of the @n strings of @s, all or none of them.
+ * Return false for allocation failed.
+ */
+bool intern_get_many(char **s, size_t n);
+
+/* Drop a reference to @p, a copy returned by the table */
+void intern_put(const char *p);
+
+/* Drop the references intern_get_many() took to the @n strings of @s */
+void intern_put_many(char **s, size_t n);
+
+/* Number of references held in total */
+size_t intern_refs(void);
+
+#endif /* LAB0_INTERN_H */
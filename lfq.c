@@ -0,0 +1,239 @@
+/* The nodes come from the system allocator: the harness keeps its books
+ * without any locking, so it must not be entered from several threads.
+ */
+#define INTERNAL 1
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "lfq.h"
+
+/* Hazard pointers per thread: dequeue protects the head and its successor */
+#define LFQ_HAZARDS 2
+
+#define LFQ_CACHE_LINE 64
+
+typedef struct lfq_node {
+    _Atomic(struct lfq_node *) next;
+    element_t *el;
+} lfq_node_t;
+
+/**
+ * lfq_thread_t - Reclamation state of a thread
+ * @hp: nodes the thread is about to dereference, not to be freed
+ * @retired: nodes unlinked by the thread and waiting to be freed
+ * @nretired: number of nodes in @retired
+ * @hazards: scratch space to collect the hazard pointers of all threads
+ */
+typedef struct {
+    _Alignas(LFQ_CACHE_LINE) _Atomic(lfq_node_t *) hp[LFQ_HAZARDS];
+    lfq_node_t **retired;
+    size_t nretired;
+    lfq_node_t **hazards;
+} lfq_thread_t;
+
+/**
+ * struct lfq - Queue of Michael and Scott
+ * @head: dummy node, the element is in the node after it
+ * @tail: last node or, while an enqueue is in progress, the one before it
+ * @nthreads: number of entries in @threads
+ * @threads: per thread state
+ */
+struct lfq {
+    _Alignas(LFQ_CACHE_LINE) _Atomic(lfq_node_t *) head;
+    _Alignas(LFQ_CACHE_LINE) _Atomic(lfq_node_t *) tail;
+    int nthreads;
+    lfq_thread_t *threads;
+};
+
+/* Retired nodes of a thread before it scans the hazard pointers.  It is more
+ * than the hazard pointers in total, so every scan frees some nodes.
+ */
+static inline size_t lfq_retire_limit(const lfq_t *q)
+{
+    return 2 * q->nthreads * LFQ_HAZARDS;
+}
+
+lfq_t *lfq_new(int nthreads)
+{
+    if (nthreads < 1)
+        return NULL;
+
+    lfq_t *q = aligned_alloc(LFQ_CACHE_LINE, sizeof(lfq_t));
+    if (!q)
+        return NULL;
+    q->nthreads = nthreads;
+    q->threads = aligned_alloc(LFQ_CACHE_LINE, nthreads * sizeof(lfq_thread_t));
+    lfq_node_t *dummy = malloc(sizeof(lfq_node_t));
+    if (!q->threads || !dummy) {
+        free(dummy);
+        free(q->threads);
+        free(q);
+        return NULL;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        lfq_thread_t *t = &q->threads[i];
+        for (int j = 0; j < LFQ_HAZARDS; j++)
+            atomic_init(&t->hp[j], NULL);
+        t->retired = malloc(lfq_retire_limit(q) * sizeof(lfq_node_t *));
+        t->hazards = malloc(nthreads * LFQ_HAZARDS * sizeof(lfq_node_t *));
+        t->nretired = 0;
+        if (!t->retired || !t->hazards) {
+            free(t->retired);
+            free(t->hazards);
+            while (i--) {
+                free(q->threads[i].retired);
+                free(q->threads[i].hazards);
+            }
+            free(dummy);
+            free(q->threads);
+            free(q);
+            return NULL;
+        }
+    }
+
+    atomic_init(&dummy->next, NULL);
+    dummy->el = NULL;
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    return q;
+}
+
+void lfq_free(lfq_t *q)
+{
+    if (!q)
+        return;
+
+    lfq_node_t *node = atomic_load(&q->head);
+    while (node) {
+        lfq_node_t *next = atomic_load(&node->next);
+        free(node);
+        node = next;
+    }
+    for (int i = 0; i < q->nthreads; i++) {
+        lfq_thread_t *t = &q->threads[i];
+        for (size_t j = 0; j < t->nretired; j++)
+            free(t->retired[j]);
+        free(t->retired);
+        free(t->hazards);
+    }
+    free(q->threads);
+    free(q);
+}
+
+/* Free the retired nodes of @t no thread holds a hazard pointer to */
+static void lfq_scan(lfq_t *q, lfq_thread_t *t)
+{
+    size_t nh = 0;
+    for (int i = 0; i < q->nthreads; i++) {
+        for (int j = 0; j < LFQ_HAZARDS; j++) {
+            lfq_node_t *hp = atomic_load(&q->threads[i].hp[j]);
+            if (hp)
+                t->hazards[nh++] = hp;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < t->nretired; i++) {
+        lfq_node_t *node = t->retired[i];
+        size_t j = 0;
+        while (j < nh && t->hazards[j] != node)
+            j++;
+        if (j < nh)
+            t->retired[kept++] = node;
+        else
+            free(node);
+    }
+    t->nretired = kept;
+}
+
+static void lfq_retire(lfq_t *q, lfq_thread_t *t, lfq_node_t *node)
+{
+    t->retired[t->nretired++] = node;
+    if (t->nretired == lfq_retire_limit(q))
+        lfq_scan(q, t);
+}
+
+/* Load *@src into hazard pointer @hp, retrying until it is seen unchanged
+ * after being published, so it cannot have been freed in between
+ */
+static inline lfq_node_t *lfq_protect(_Atomic(lfq_node_t *) *hp,
+                                      _Atomic(lfq_node_t *) *src)
+{
+    lfq_node_t *node = atomic_load(src);
+    for (;;) {
+        atomic_store(hp, node);
+        lfq_node_t *again = atomic_load(src);
+        if (again == node)
+            return node;
+        node = again;
+    }
+}
+
+bool lfq_enqueue(lfq_t *q, int tid, element_t *e)
+{
+    lfq_node_t *node = malloc(sizeof(lfq_node_t));
+    if (!node)
+        return false;
+    atomic_init(&node->next, NULL);
+    node->el = e;
+
+    lfq_thread_t *t = &q->threads[tid];
+    for (;;) {
+        lfq_node_t *tail = lfq_protect(&t->hp[0], &q->tail);
+        lfq_node_t *next = atomic_load(&tail->next);
+        if (tail != atomic_load(&q->tail))
+            continue;
+        if (next) {
+            /* help the enqueue in progress to swing the tail */
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        lfq_node_t *expected = NULL;
+        if (atomic_compare_exchange_strong(&tail->next, &expected, node)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, node);
+            break;
+        }
+    }
+    atomic_store(&t->hp[0], NULL);
+    return true;
+}
+
+element_t *lfq_dequeue(lfq_t *q, int tid)
+{
+    lfq_thread_t *t = &q->threads[tid];
+    lfq_node_t *head;
+    element_t *e = NULL;
+
+    for (;;) {
+        head = lfq_protect(&t->hp[0], &q->head);
+        lfq_node_t *tail = atomic_load(&q->tail);
+        lfq_node_t *next = lfq_protect(&t->hp[1], &head->next);
+        if (head != atomic_load(&q->head))
+            continue;
+        if (!next) {
+            /* empty, forget what an earlier attempt may have read */
+            head = NULL;
+            e = NULL;
+            break;
+        }
+        if (head == tail) {
+            /* the tail lags behind, help it along first */
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        e = next->el;
+        if (atomic_compare_exchange_strong(&q->head, &head, next))
+            break;
+    }
+
+    atomic_store(&t->hp[0], NULL);
+    atomic_store(&t->hp[1], NULL);
+    /* the old dummy is unlinked, the node of @e is the dummy now */
+    if (head)
+        lfq_retire(q, t, head);
+    return e;
+}
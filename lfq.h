@@ -0,0 +1,38 @@
+#ifndef LAB0_LFQ_H
+#define LAB0_LFQ_H
+
+/* Lock-free multi-producer/multi-consumer FIFO of queue elements.
+ *
+ * It is the queue of Michael and Scott, "Simple, Fast, and Practical
+ * Non-Blocking and Blocking Concurrent Queue Algorithms", with the nodes
+ * dequeued reclaimed through hazard pointers, see Michael, "Hazard Pointers:
+ * Safe Memory Reclamation for Lock-Free Objects".
+ *
+ * Every thread operating on the queue passes its own id, from 0 up to the
+ * number of threads the queue was created for, which selects its hazard
+ * pointers and its list of retired nodes.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+typedef struct lfq lfq_t;
+
+/* Create an empty queue for up to @nthreads threads, NULL for allocation
+ * failed
+ */
+lfq_t *lfq_new(int nthreads);
+
+/* Release @q along with its nodes, though not the elements still in it.
+ * No other thread may operate on @q any more.
+ */
+void lfq_free(lfq_t *q);
+
+/* Append @e at the tail of @q, false for allocation failed */
+bool lfq_enqueue(lfq_t *q, int tid, element_t *e);
+
+/* Remove the element at the head of @q, NULL if @q is empty */
+element_t *lfq_dequeue(lfq_t *q, int tid);
+
+#endif /* LAB0_LFQ_H */
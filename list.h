@@ -383,6 +383,21 @@ static inline void list_move_tail(struct list_head *node,
 #define list_last_entry(head, type, member) \
     list_entry((head)->prev, type, member)
 
+/**
+ * list_prefetch() - Hint that the memory at an address is about to be read
+ * @addr: address which is read soon
+ *
+ * Starts loading the cache line of @addr without waiting for it, so that a
+ * walk over nodes scattered in memory overlaps the loads of the nodes ahead
+ * of it with the work on the current one.  Defining LIST_NO_PREFETCH turns
+ * the hint into a no-op, which is useful to measure its effect.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(LIST_NO_PREFETCH)
+#define list_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define list_prefetch(addr) ((void) (addr))
+#endif
+
 /**
  * list_for_each - Iterate over list nodes
  * @node: list_head pointer used as iterator
@@ -452,6 +467,62 @@ static inline void list_move_tail(struct list_head *node,
         safe = list_entry(safe->member.next, typeof(*entry), member))
 #endif
 
+/**
+ * list_for_each_prefetch - Iterate over list nodes, loading ahead
+ * @node: list_head pointer used as iterator
+ * @head: pointer to the head of the list
+ *
+ * Same as list_for_each(), but prefetches the node after the next one on
+ * every step.  The next node was prefetched by the previous step, so reading
+ * its link does not stall, and two loads are always in flight.
+ */
+#define list_for_each_prefetch(node, head)                          \
+    for (node = (head)->next, list_prefetch(node->next);            \
+         node != (head);                                            \
+         node = node->next, list_prefetch(node->next->next))
+
+/**
+ * list_for_each_entry_prefetch - Iterate over a list of entries, loading ahead
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @head: Pointer to the list_head structure representing the list head.
+ * @member: Name of the list_head member within the structure type of @entry.
+ *
+ * Same as list_for_each_entry(), but prefetches the node after the next one
+ * on every step, like list_for_each_prefetch().
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_prefetch(entry, head, member)                 \
+    for (entry = list_entry((head)->next, typeof(*entry), member),        \
+        list_prefetch(entry->member.next);                                \
+         &entry->member != (head);                                        \
+         entry = list_entry(entry->member.next, typeof(*entry), member),  \
+        list_prefetch(entry->member.next->next))
+#endif
+
+/**
+ * list_for_each_entry_safe_prefetch - Iterate over a list, allowing node
+ *                                     removal and loading ahead
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @safe: Pointer to the structure type, storing the next entry for safe
+ * iteration.
+ * @head: Pointer to the list_head structure representing the list head.
+ * @member: Name of the list_head member within the structure type of @entry.
+ *
+ * Same as list_for_each_entry_safe(), but prefetches the node after @safe on
+ * every step.  @safe is read before @entry is handed to the loop body, so the
+ * body may free @entry.  Once @entry is back at @head, @safe is the first
+ * node again, which the body may have freed, so it is left alone.
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member)         \
+    for (entry = list_entry((head)->next, typeof(*entry), member),           \
+        safe = list_entry(entry->member.next, typeof(*entry), member),       \
+        list_prefetch(safe->member.next);                                    \
+         &entry->member != (head); entry = safe,                             \
+        safe = list_entry(safe->member.next, typeof(*entry), member),        \
+        list_prefetch(&entry->member != (head) ? safe->member.next : NULL))
+#endif
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
@@ -272,7 +272,7 @@ int compare(void *priv, struct list_head *a, struct list_head *b)
     const element_t *A = list_entry(a, element_t, list);
     const element_t *B = list_entry(b, element_t, list);
     bool descend = *(bool *) priv;
-    int c = strcmp(A->value, B->value);
+    int c = q_compare(A, B);
     return descend ? (c * -1) : c;
 }
 
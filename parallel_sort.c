@@ -0,0 +1,142 @@
+#include <stddef.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "list.h"
+#include "list_sort.h"
+#include "parallel_sort.h"
+#include "queue.h"
+
+/* Segments shorter than this are not worth a thread of their own */
+#define PSORT_MIN_SEGMENT 4096
+
+#define PSORT_MAX_THREADS 64
+
+/**
+ * psort_task_t - Segment of the queue sorted by a group of threads
+ * @head: the segment, cut out of the queue
+ * @n: number of elements in @head
+ * @nthreads: number of threads available to sort @head
+ * @descend: whether or not to sort in descending order
+ */
+typedef struct {
+    struct list_head head;
+    size_t n;
+    int nthreads;
+    bool descend;
+} psort_task_t;
+
+/* Stable merge of the sorted list @b into the sorted list @a */
+static void psort_merge(struct list_head *a, struct list_head *b, bool descend)
+{
+    struct list_head *pos = a->next;
+    while (!list_empty(b)) {
+        if (pos == a) {
+            list_splice_tail_init(b, a);
+            return;
+        }
+        element_t *x = list_entry(pos, element_t, list);
+        element_t *y = list_first_entry(b, element_t, list);
+        int c = q_compare(x, y);
+        if (descend ? c < 0 : c > 0)
+            list_move_tail(&y->list, pos); /* y goes right before x */
+        else
+            pos = pos->next;
+    }
+}
+
+static void *psort_worker(void *arg);
+
+/* Hand the tail of @t over to another thread, sort the rest on this one and
+ * merge the two halves once both are done.  Threads further down the tree
+ * split their segments the same way, so the merges of the lower levels run
+ * in parallel as well.
+ */
+static void psort_run(psort_task_t *t)
+{
+    if (t->nthreads < 2 || t->n < 2 * PSORT_MIN_SEGMENT) {
+        linux_list_sort(&t->head, t->descend);
+        return;
+    }
+
+    psort_task_t right = {
+        .nthreads = t->nthreads / 2,
+        .descend = t->descend,
+    };
+    right.n = t->n * right.nthreads / t->nthreads;
+    t->n -= right.n;
+    t->nthreads -= right.nthreads;
+
+    /* cut the last right.n elements out into the right segment */
+    struct list_head left, *last = t->head.prev;
+    for (size_t i = 0; i < right.n; i++)
+        last = last->prev;
+    INIT_LIST_HEAD(&left);
+    INIT_LIST_HEAD(&right.head);
+    list_cut_position(&left, &t->head, last);
+    list_splice_init(&t->head, &right.head);
+    list_splice(&left, &t->head);
+
+    /* Keep signals away from the workers: the alarm used to time out
+     * operations long jumps back into the stack of the main thread.
+     */
+    pthread_t tid;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&tid, NULL, psort_worker, &right);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    psort_run(t);
+    if (err)
+        psort_run(&right); /* no thread to spare, do it here */
+    else
+        pthread_join(tid, NULL);
+
+    psort_merge(&t->head, &right.head, t->descend);
+    t->n += right.n;
+    t->nthreads += right.nthreads;
+}
+
+static void *psort_worker(void *arg)
+{
+    psort_run(arg);
+    return NULL;
+}
+
+void parallel_sort(struct list_head *head, bool descend, int nthreads)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
+
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > PSORT_MAX_THREADS)
+        nthreads = PSORT_MAX_THREADS;
+
+    psort_task_t t = {
+        .nthreads = nthreads > 0 ? nthreads : 1,
+        .descend = descend,
+    };
+    INIT_LIST_HEAD(&t.head);
+    list_splice_init(head, &t.head);
+    /* @head may be any list of elements, not necessarily a whole queue */
+    struct list_head *li;
+    list_for_each (li, &t.head)
+        t.n++;
+
+    /* The alarm timing out operations long jumps out of the main thread,
+     * which would leave the workers relinking the elements of a queue about
+     * to be freed through tasks on a stack gone.  Hold it back until all of
+     * them are joined and the queue is whole again, then let it fire.
+     */
+    sigset_t alarm_set, old;
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alarm_set, &old);
+    psort_run(&t);
+    list_splice(&t.head, head);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
@@ -0,0 +1,11 @@
+#ifndef LAB0_PARALLEL_SORT_H
+#define LAB0_PARALLEL_SORT_H
+
+/* Sort @head with up to @nthreads threads, all online processors if not
+ * positive.  It never allocates through the harness, so it is fine to run in
+ * noallocate mode.  SIGALRM is held back until the sort is done, so that a
+ * time limit cannot long jump out while threads still work on the list.
+ */
+void parallel_sort(struct list_head *head, bool descend, int nthreads);
+
+#endif /* LAB0_PARALLEL_SORT_H */
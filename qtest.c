@@ -3,8 +3,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,14 +22,28 @@
 #include <time.h>
 #endif
 
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 #include "dudect/cpucycles.h"
 #include "dudect/fixture.h"
 #include "list.h"
+#include "bottom_up_sort.h"
 #include "list_sort.h"
+#include "parallel_sort.h"
+#include "radix_sort.h"
 #include "random.h"
+#include "timsort.h"
 
 /* Shannon entropy */
-extern double shannon_entropy(const uint8_t *input_data);
+extern double shannon_entropy(const uint8_t *input_data, size_t len);
 extern int show_entropy;
 
 /* Our program needs to use regular malloc/free */
@@ -47,6 +64,8 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "lfq.h"
+#include "wsq.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -55,7 +74,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -77,6 +95,9 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Number of threads for the parallel sort, all processors if not positive */
+static int threads = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -103,9 +124,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -118,7 +136,6 @@ static bool do_free(int argc, char *argv[])
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -182,6 +199,99 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Whether @e holds its string in place, either along with it or as one of
+ * the copies shared through the intern table, whatever the current mode
+ */
+static bool string_in_place(const element_t *e)
+{
+    return e->value == e->data || intern_find(e->value, e->len) == e->value;
+}
+
+/* How many insertions make it worth going through the batch API */
+#define BATCH_INSERT_MIN 1024
+
+/* insertion of a batch by q_insert_head_many and q_insert_tail_many */
+static bool queue_insert_many(position_t pos,
+                              char *inserts,
+                              bool need_rand,
+                              int reps)
+{
+    char **strs = malloc(reps * sizeof(char *));
+    char *pool = need_rand ? malloc(reps * MAX_RANDSTR_LEN) : NULL;
+    if (!strs || (need_rand && !pool)) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for inserted "
+               "strings");
+        free(strs);
+        free(pool);
+        return false;
+    }
+
+    for (int r = 0; r < reps; r++) {
+        strs[r] = inserts;
+        if (need_rand) {
+            strs[r] = pool + r * MAX_RANDSTR_LEN;
+            fill_rand_string(strs[r], MAX_RANDSTR_LEN);
+        }
+    }
+
+    bool ok = true, rval = false;
+    if (exception_setup(true))
+        rval = pos == POS_TAIL ? q_insert_tail_many(current->q, strs, reps)
+                               : q_insert_head_many(current->q, strs, reps);
+    exception_cancel();
+
+    if (rval) {
+        current->size += reps;
+        /* The batch went in at one end of the queue with its last string
+         * outermost, so walk it from there in reverse order of insertion.
+         */
+        q_iter_t it;
+        element_t *entry = pos == POS_TAIL ? q_iter_last(&it, current->q)
+                                           : q_iter_first(&it, current->q);
+        for (int r = reps - 1; r >= 0; r--) {
+            if (!entry) {
+                report(1, "ERROR: Queue lost elements of inserted batch");
+                ok = false;
+                break;
+            } else if (entry->value == strs[r]) {
+                report(1,
+                       "ERROR: Need to allocate and copy string for new "
+                       "queue element");
+                ok = false;
+                break;
+            } else if (!string_in_place(entry)) {
+                report(1,
+                       "ERROR: String should be stored along with its "
+                       "queue element");
+                ok = false;
+                break;
+            } else if (strcmp(entry->value, strs[r])) {
+                report(1, "ERROR: Inserted %s, but queue holds %s", strs[r],
+                       entry->value);
+                ok = false;
+                break;
+            }
+            entry = pos == POS_TAIL ? q_iter_prev(&it) : q_iter_next(&it);
+        }
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit)
+            report(2, "Insertion of %d strings failed", reps);
+        else {
+            report(1,
+                   "ERROR: Insertion of %d strings failed (%d failures "
+                   "total)",
+                   reps, fail_count);
+            ok = false;
+        }
+    }
+
+    free(strs);
+    free(pool);
+    return ok && !error_check();
+}
+
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
@@ -228,6 +338,12 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    if (current && reps >= BATCH_INSERT_MIN) {
+        ok = queue_insert_many(pos, inserts, need_rand, reps);
+        q_show(3);
+        return ok;
+    }
+
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
@@ -236,10 +352,10 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                                         : q_insert_head(current->q, inserts);
             if (rval) {
                 current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
+                q_iter_t it;
+                element_t *entry = pos == POS_TAIL
+                                       ? q_iter_last(&it, current->q)
+                                       : q_iter_first(&it, current->q);
                 char *cur_inserts = entry->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
@@ -250,12 +366,26 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (!string_in_place(entry)) {
+                    report(1,
+                           "ERROR: String should be stored along with its "
+                           "queue element");
+                    ok = false;
+                    break;
+                } else if (r == 1 && lasts == cur_inserts &&
+                           cur_inserts == entry->data) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
                     ok = false;
                     break;
+                } else if (intern_mode && !need_rand && r == 1 && lasts &&
+                           lasts != cur_inserts) {
+                    report(1,
+                           "ERROR: Identical strings should share one "
+                           "interned copy");
+                    ok = false;
+                    break;
                 }
                 lasts = cur_inserts;
             } else {
@@ -419,6 +549,66 @@ static inline bool do_rt(int argc, char *argv[])
     return queue_remove(POS_TAIL, argc, argv);
 }
 
+/* removal by q_pop_head and q_pop_tail, which hand over the string in place */
+static bool queue_pop(position_t pos, int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    bool check = argc > 1;
+    if (!current || !current->size)
+        report(3, "Warning: Calling pop %s on empty queue",
+               pos == POS_TAIL ? "tail" : "head");
+    error_check();
+
+    element_t *re = NULL;
+    if (current && exception_setup(true))
+        re = pos == POS_TAIL ? q_pop_tail(current->q) : q_pop_head(current->q);
+    exception_cancel();
+
+    bool ok = true;
+    if (re) {
+        if (!string_in_place(re)) {
+            report(1,
+                   "ERROR: String should be stored along with its queue "
+                   "element");
+            ok = false;
+        } else if (check && strcmp(re->value, argv[1])) {
+            report(1, "ERROR: Removed value %s != expected value %s",
+                   re->value, argv[1]);
+            ok = false;
+        } else {
+            report(2, "Removed %s from queue", re->value);
+        }
+        q_release_element(re);
+        current->size--;
+    } else {
+        fail_count++;
+        if (!check && fail_count < fail_limit) {
+            report(2, "Removal from queue failed");
+        } else {
+            report(1, "ERROR: Removal from queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static inline bool do_ph(int argc, char *argv[])
+{
+    return queue_pop(POS_HEAD, argc, argv);
+}
+
+static inline bool do_pt(int argc, char *argv[])
+{
+    return queue_pop(POS_TAIL, argc, argv);
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -433,35 +623,34 @@ static bool do_dedup(int argc, char *argv[])
 
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
+    q_iter_t it;
 
     // Copy current->q to l_copy
-    if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
-            size_t slen;
-            tmp = malloc(sizeof(element_t));
-            if (!tmp)
-                break;
-            INIT_LIST_HEAD(&tmp->list);
-            slen = strlen(item->value) + 1;
-            tmp->value = malloc(slen);
-            if (!tmp->value) {
-                free(tmp);
-                break;
-            }
-            memcpy(tmp->value, item->value, slen);
-            list_add_tail(&tmp->list, &l_copy);
+    for (item = q_iter_first(&it, current->q); item; item = q_iter_next(&it)) {
+        size_t slen;
+        tmp = malloc(sizeof(element_t));
+        if (!tmp)
+            break;
+        INIT_LIST_HEAD(&tmp->list);
+        slen = item->len + 1;
+        tmp->value = malloc(slen);
+        if (!tmp->value) {
+            free(tmp);
+            break;
         }
-        // Return false if the loop does not leave properly
-        if (&item->list != current->q) {
-            list_for_each_entry_safe (item, tmp, &l_copy, list) {
-                free(item->value);
-                free(item);
-            }
-            report(1,
-                   "INTERNAL ERROR.  Could not allocate space for "
-                   "duplicate checking");
-            return false;
+        memcpy(tmp->value, item->value, slen);
+        list_add_tail(&tmp->list, &l_copy);
+    }
+    // Return false if the loop does not leave properly
+    if (item) {
+        list_for_each_entry_safe (item, tmp, &l_copy, list) {
+            free(item->value);
+            free(item);
         }
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for "
+               "duplicate checking");
+        return false;
     }
 
     bool ok = true;
@@ -478,7 +667,7 @@ static bool do_dedup(int argc, char *argv[])
         return false;
     }
 
-    struct list_head *l_tmp = current->q->next;
+    element_t *l_tmp = q_iter_first(&it, current->q);
     bool is_this_dup = false;
     // Compare between new list and old one
     list_for_each_entry (item, &l_copy, list) {
@@ -490,16 +679,14 @@ static bool do_dedup(int argc, char *argv[])
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
-        } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
+        } else if (l_tmp && strcmp(l_tmp->value, item->value) == 0)
+            l_tmp = q_iter_next(&it);
         else
             ok = false;
         is_this_dup = is_next_dup;
     }
     // All elements in new list should be traversed
-    ok = ok && l_tmp == current->q;
+    ok = ok && !l_tmp;
     if (!ok)
         report(1,
                "ERROR: Duplicate strings are in queue or distinct strings are "
@@ -578,6 +765,86 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Report the memory held through the harness and the calls made to it */
+static void mem_report(int vlevel, const mem_stats_t *st)
+{
+    report(vlevel,
+           "Memory: %zu bytes in %zu blocks and %zu objects, peak %zu bytes",
+           st->bytes, st->blocks, st->objects, st->peak_bytes);
+    report(vlevel, "Calls: %zu allocations, %zu frees", st->allocs,
+           st->frees);
+}
+
+static int mem_site_cmp(const void *a, const void *b)
+{
+    size_t x = ((const mem_site_t *) a)->bytes;
+    size_t y = ((const mem_site_t *) b)->bytes;
+    return (x < y) - (x > y);
+}
+
+/* Report the live blocks by the call site which allocated them, the sites
+ * holding the most bytes first
+ */
+static void mem_site_report(int vlevel)
+{
+    mem_site_t *sites = malloc(MEM_SITES * sizeof(mem_site_t));
+    if (!sites) {
+        report(1, "ERROR: Could not allocate space for the call sites");
+        return;
+    }
+    size_t n = mem_sites(sites);
+    qsort(sites, n, sizeof(mem_site_t), mem_site_cmp);
+    for (size_t i = 0; i < n; i++) {
+#if defined(__GLIBC__) || defined(__APPLE__)
+        char **sym = backtrace_symbols((void *const *) &sites[i].addr, 1);
+#else
+        char **sym = NULL;
+#endif
+        if (sym) {
+            report(vlevel, "%zu bytes in %zu blocks from %s", sites[i].bytes,
+                   sites[i].blocks, sym[0]);
+        } else {
+            report(vlevel, "%zu bytes in %zu blocks from %p", sites[i].bytes,
+                   sites[i].blocks, sites[i].addr);
+        }
+        free(sym);
+    }
+    free(sites);
+}
+
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    mem_stats_t st;
+    mem_stats(&st);
+    mem_report(1, &st);
+
+    size_t elements = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain)
+        elements += ctx->size;
+    if (elements) {
+        report(1, "%.1f bytes per element over %zu elements",
+               (double) st.bytes / elements, elements);
+    }
+
+    for (int i = 0; i < MEM_HIST_BUCKETS; i++) {
+        if (!st.hist[i])
+            continue;
+        size_t lo = i ? (size_t) 1 << i : 0;
+        size_t hi = ((size_t) 1 << i) * 2 - 1;
+        report(1, "%10zu - %-10zu bytes: %zu", lo, hi, st.hist[i]);
+    }
+
+    if (mem_profile)
+        mem_site_report(1);
+    return true;
+}
+
 bool do_sort(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -602,12 +869,13 @@ bool do_sort(int argc, char *argv[])
  * stability of the sort. So, MAX_NODES is used to limit the number of elements
  * to check the stability of the sort. */
 #define MAX_NODES 100000
-    struct list_head *nodes[MAX_NODES];
+    element_t *nodes[MAX_NODES];
     unsigned no = 0;
     if (current && current->size && current->size <= MAX_NODES) {
-        element_t *entry;
-        list_for_each_entry (entry, current->q, list)
-            nodes[no++] = &entry->list;
+        q_iter_t it;
+        for (element_t *entry = q_iter_first(&it, current->q); entry;
+             entry = q_iter_next(&it))
+            nodes[no++] = entry;
     } else if (current && current->size > MAX_NODES)
         report(1,
                "Warning: Skip checking the stability of the sort because the "
@@ -617,10 +885,24 @@ bool do_sort(int argc, char *argv[])
     if (current && exception_setup(true)) {
         int64_t start, end;
         start = cpucycles();
-        if (sort == 0)
+        if (sort == 0) {
             q_sort(current->q, descend);
-        else if (sort == 1)
-            linux_list_sort(current->q, descend);
+        } else {
+            /* the other sorts work on a list of the elements */
+            LIST_HEAD(l);
+            q_detach(current->q, &l);
+            if (sort == 1)
+                linux_list_sort(&l, descend);
+            else if (sort == 2)
+                radix_sort(&l, descend);
+            else if (sort == 3)
+                bottom_up_sort(&l, descend);
+            else if (sort == 4)
+                parallel_sort(&l, descend, threads);
+            else if (sort == 5)
+                tim_sort(&l, descend);
+            q_attach(current->q, &l);
+        }
         end = cpucycles();
         printf("sort cpucycles: %ld\n", end - start);
     }
@@ -629,12 +911,11 @@ bool do_sort(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item, *next_item = q_iter_first(&it, current->q);
+        while ((item = next_item) && --cnt &&
+               (next_item = q_iter_next(&it))) {
             /* Ensure each element in ascending/descending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
             if (!descend && strcmp(item->value, next_item->value) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
@@ -651,11 +932,11 @@ bool do_sort(int argc, char *argv[])
                 !strcmp(item->value, next_item->value)) {
                 bool unstable = false;
                 for (unsigned i = 0; i < MAX_NODES; i++) {
-                    if (nodes[i] == cur_l->next) {
+                    if (nodes[i] == next_item) {
                         unstable = true;
                         break;
                     }
-                    if (nodes[i] == cur_l) {
+                    if (nodes[i] == item) {
                         break;
                     }
                 }
@@ -757,11 +1038,10 @@ static bool do_ascend(int argc, char *argv[])
 
     cnt = current->size;
     if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
+        q_iter_t it;
+        element_t *item, *next_item = q_iter_first(&it, current->q);
+        while ((item = next_item) && --cnt &&
+               (next_item = q_iter_next(&it))) {
             if (strcmp(item->value, next_item->value) > 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
@@ -804,11 +1084,10 @@ static bool do_descend(int argc, char *argv[])
 
     cnt = current->size;
     if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
+        q_iter_t it;
+        element_t *item, *next_item = q_iter_first(&it, current->q);
+        while ((item = next_item) && --cnt &&
+               (next_item = q_iter_next(&it))) {
             if (strcmp(item->value, next_item->value) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
@@ -865,14 +1144,37 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    /* q_merge may not allocate, so the room it needs is set aside first */
     int len = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain)
+        len += q_size(ctx->q);
+    ctx = list_first_entry(&chain.head, queue_contex_t, chain);
+    bool reserved = false;
+    if (exception_setup(true))
+        reserved = q_reserve(ctx->q, len);
+    exception_cancel();
+    if (!reserved) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Reserving room for %d elements failed", len);
+            return true;
+        }
+        report(1,
+               "ERROR: Reserving room for %d elements failed (%d failures "
+               "total)",
+               len, fail_count);
+        return false;
+    }
+
+    len = 0;
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         len = q_merge(&chain.head, descend);
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -891,12 +1193,11 @@ static bool do_merge(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item, *next_item = q_iter_first(&it, current->q);
+        while ((item = next_item) && --len &&
+               (next_item = q_iter_next(&it))) {
             /* Ensure each element in ascending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
             if (!descend && strcmp(item->value, next_item->value) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
@@ -923,6 +1224,606 @@ static bool do_merge(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Largest number of threads a stress run may start */
+#define STRESS_MAX_THREADS 256
+
+/**
+ * stress_t - State shared by the threads of a stress run
+ * @q: the queue under test
+ * @elems: the elements passed around, @ops of them
+ * @producer: producer enqueuing each element
+ * @seen: times each element was dequeued
+ * @consumed: number of elements dequeued so far
+ * @dropped: number of elements which could not be enqueued
+ * @reordered: number of elements dequeued before an earlier one of the same
+ *             producer by a single consumer
+ * @go: set once all threads are up, for them to start at the same time
+ * @stop: set to make the threads give up early
+ * @ops: number of elements in total
+ */
+typedef struct {
+    lfq_t *q;
+    element_t *elems;
+    int *producer;
+    atomic_uchar *seen;
+    atomic_size_t consumed, dropped, reordered;
+    atomic_bool go, stop;
+    size_t ops;
+} stress_t;
+
+/**
+ * stress_arg_t - Work of a thread of a stress run
+ * @st: the shared state
+ * @tid: id of the thread for the queue
+ * @first: first element a producer enqueues
+ * @last: one past the last element a producer enqueues
+ * @latest: latest element a consumer got from each producer
+ */
+typedef struct {
+    stress_t *st;
+    int tid;
+    size_t first, last;
+    size_t *latest;
+} stress_arg_t;
+
+static void *stress_producer(void *arg)
+{
+    stress_arg_t *a = arg;
+    stress_t *st = a->st;
+
+    while (!atomic_load(&st->go))
+        sched_yield();
+    for (size_t i = a->first; i < a->last && !atomic_load(&st->stop); i++) {
+        if (!lfq_enqueue(st->q, a->tid, &st->elems[i])) {
+            /* consumers are not to wait for it */
+            atomic_fetch_add(&st->seen[i], 1);
+            atomic_fetch_add(&st->dropped, 1);
+        }
+    }
+    return NULL;
+}
+
+static void *stress_consumer(void *arg)
+{
+    stress_arg_t *a = arg;
+    stress_t *st = a->st;
+
+    while (!atomic_load(&st->go))
+        sched_yield();
+    while (!atomic_load(&st->stop) &&
+           atomic_load(&st->consumed) + atomic_load(&st->dropped) < st->ops) {
+        element_t *e = lfq_dequeue(st->q, a->tid);
+        if (!e) {
+            sched_yield();
+            continue;
+        }
+        size_t i = e - st->elems;
+        int p = st->producer[i];
+        if (a->latest[p] != SIZE_MAX && a->latest[p] >= i)
+            atomic_fetch_add(&st->reordered, 1);
+        a->latest[p] = i;
+        atomic_fetch_add(&st->seen[i], 1);
+        atomic_fetch_add(&st->consumed, 1);
+    }
+    return NULL;
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    int producers, consumers, ops;
+    if (argc != 4 || !get_int(argv[1], &producers) ||
+        !get_int(argv[2], &consumers) || !get_int(argv[3], &ops)) {
+        report(1, "%s takes arguments <producers> <consumers> <ops>", argv[0]);
+        return false;
+    }
+    if (producers < 1 || consumers < 1 ||
+        producers + consumers > STRESS_MAX_THREADS || ops < 0) {
+        report(1,
+               "Need at least one producer and one consumer, %d threads at "
+               "most, and a non-negative number of operations",
+               STRESS_MAX_THREADS);
+        return false;
+    }
+
+    int nthreads = producers + consumers;
+    stress_t st = {.ops = ops};
+    atomic_init(&st.consumed, 0);
+    atomic_init(&st.dropped, 0);
+    atomic_init(&st.reordered, 0);
+    atomic_init(&st.go, false);
+    atomic_init(&st.stop, false);
+    st.q = lfq_new(nthreads);
+    st.elems = calloc(ops + 1, sizeof(element_t));
+    st.producer = calloc(ops + 1, sizeof(int));
+    st.seen = calloc(ops + 1, sizeof(atomic_uchar));
+    stress_arg_t *args = calloc(nthreads, sizeof(stress_arg_t));
+    pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
+    size_t *latest = malloc(consumers * producers * sizeof(size_t));
+
+    bool ok = false;
+    int started = 0;
+    if (!st.q || !st.elems || !st.producer || !st.seen || !args || !tids ||
+        !latest) {
+        report(1, "ERROR: Could not allocate space for the stress run");
+        goto out;
+    }
+
+    for (int p = 0; p < producers; p++) {
+        args[p].first = (size_t) ops * p / producers;
+        args[p].last = (size_t) ops * (p + 1) / producers;
+        for (size_t i = args[p].first; i < args[p].last; i++)
+            st.producer[i] = p;
+    }
+    for (int c = 0; c < consumers; c++) {
+        args[producers + c].latest = latest + c * producers;
+        for (int p = 0; p < producers; p++)
+            args[producers + c].latest[p] = SIZE_MAX;
+    }
+
+    /* Keep the signals of the console away from the workers */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; started < nthreads; started++) {
+        args[started].st = &st;
+        args[started].tid = started;
+        if (pthread_create(&tids[started], NULL,
+                           started < producers ? stress_producer
+                                               : stress_consumer,
+                           &args[started]))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (started < nthreads) {
+        report(1, "ERROR: Could not start thread %d of the stress run",
+               started);
+        atomic_store(&st.stop, true);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    atomic_store(&st.go, true);
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (started < nthreads)
+        goto out;
+
+    size_t lost = 0, duplicated = 0;
+    for (size_t i = 0; i < st.ops; i++) {
+        if (!st.seen[i])
+            lost++;
+        else if (st.seen[i] > 1)
+            duplicated++;
+    }
+    double secs =
+        (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    report(1,
+           "%d producers, %d consumers: %d elements in %.3f seconds, %.0f "
+           "elements/s",
+           producers, consumers, ops, secs, secs > 0 ? ops / secs : 0.0);
+
+    ok = true;
+    if (atomic_load(&st.dropped)) {
+        report(1, "ERROR: %zu elements could not be enqueued",
+               atomic_load(&st.dropped));
+        ok = false;
+    }
+    if (lost || duplicated) {
+        report(1, "ERROR: %zu elements lost, %zu dequeued more than once",
+               lost, duplicated);
+        ok = false;
+    }
+    if (atomic_load(&st.reordered)) {
+        report(1,
+               "ERROR: %zu elements dequeued before earlier ones of the same "
+               "producer",
+               atomic_load(&st.reordered));
+        ok = false;
+    }
+
+out:
+    lfq_free(st.q);
+    free(st.elems);
+    free(st.producer);
+    free(st.seen);
+    free(args);
+    free(tids);
+    free(latest);
+    return ok && !error_check();
+}
+
+/* Deepest task tree the scheduler benchmark builds */
+#define SCHED_MAX_DEPTH 22
+
+/* Rounds of busy work each task of the benchmark does */
+#define SCHED_WORK 256
+
+/**
+ * sched_t - State shared by the workers of a scheduler benchmark run
+ * @deques: the deque owned by each worker
+ * @tasks: the task tree, children of task i are tasks 2i+1 and 2i+2
+ * @seen: times each task was run
+ * @done: number of tasks run so far
+ * @go: set once all workers are up, for them to start at the same time
+ * @stop: set to make the workers give up early
+ * @ntasks: number of tasks in the tree
+ * @nworkers: number of workers
+ */
+typedef struct {
+    wsq_t **deques;
+    element_t *tasks;
+    atomic_uchar *seen;
+    atomic_size_t done;
+    atomic_bool go, stop;
+    size_t ntasks;
+    int nworkers;
+} sched_t;
+
+/**
+ * sched_arg_t - Worker of a scheduler benchmark run
+ * @s: the shared state
+ * @id: index of the worker and of its deque
+ * @steals: number of tasks this worker stole from others
+ * @sink: results of the busy work, so that it is not optimized away
+ */
+typedef struct {
+    sched_t *s;
+    int id;
+    size_t steals;
+    uint64_t sink;
+} sched_arg_t;
+
+static uint64_t sched_work(uint64_t x)
+{
+    for (int i = 0; i < SCHED_WORK; i++)
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    return x;
+}
+
+static void *sched_worker(void *arg)
+{
+    sched_arg_t *a = arg;
+    sched_t *s = a->s;
+    wsq_t *own = s->deques[a->id];
+    uint32_t rnd = 2654435761U * (a->id + 1);
+
+    while (!atomic_load(&s->go))
+        sched_yield();
+    while (!atomic_load(&s->stop) && atomic_load(&s->done) < s->ntasks) {
+        element_t *e = wsq_pop(own);
+        if (!e && s->nworkers > 1) {
+            /* out of work, try a random victim other than itself */
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 17;
+            rnd ^= rnd << 5;
+            int victim = rnd % (s->nworkers - 1);
+            if (victim >= a->id)
+                victim++;
+            if ((e = wsq_steal(s->deques[victim])))
+                a->steals++;
+        }
+        if (!e) {
+            sched_yield();
+            continue;
+        }
+
+        size_t i = e - s->tasks;
+        for (size_t c = 2 * i + 1; c <= 2 * i + 2 && c < s->ntasks; c++) {
+            if (!wsq_push(own, &s->tasks[c]))
+                atomic_store(&s->stop, true);
+        }
+        a->sink += sched_work(i);
+        atomic_fetch_add(&s->seen[i], 1);
+        atomic_fetch_add(&s->done, 1);
+    }
+    return NULL;
+}
+
+/* Run the whole task tree on @nworkers workers, false if it went wrong */
+static bool sched_run(sched_t *s, int nworkers, double *secs, size_t *steals)
+{
+    sched_arg_t args[STRESS_MAX_THREADS];
+    pthread_t tids[STRESS_MAX_THREADS];
+    wsq_t *deques[STRESS_MAX_THREADS];
+    int ndeques = 0, started = 0;
+    bool ok = false;
+
+    s->deques = deques;
+    s->nworkers = nworkers;
+    atomic_store(&s->done, 0);
+    atomic_store(&s->go, false);
+    atomic_store(&s->stop, false);
+    for (size_t i = 0; i < s->ntasks; i++)
+        atomic_store(&s->seen[i], 0);
+
+    for (; ndeques < nworkers; ndeques++) {
+        if (!(deques[ndeques] = wsq_new()))
+            break;
+    }
+    if (ndeques < nworkers || !wsq_push(deques[0], &s->tasks[0])) {
+        report(1, "ERROR: Could not allocate space for the deques");
+        goto out;
+    }
+
+    /* Keep the signals of the console away from the workers */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; started < nworkers; started++) {
+        args[started] = (sched_arg_t){.s = s, .id = started};
+        if (pthread_create(&tids[started], NULL, sched_worker, &args[started]))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (started < nworkers) {
+        report(1, "ERROR: Could not start worker %d", started);
+        atomic_store(&s->stop, true);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    atomic_store(&s->go, true);
+    *steals = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+        *steals += args[i].steals;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    if (started < nworkers)
+        goto out;
+    if (atomic_load(&s->stop)) {
+        report(1, "ERROR: Could not allocate space to push a task");
+        goto out;
+    }
+
+    size_t missed = 0, repeated = 0;
+    for (size_t i = 0; i < s->ntasks; i++) {
+        if (!s->seen[i])
+            missed++;
+        else if (s->seen[i] > 1)
+            repeated++;
+    }
+    if (missed || repeated) {
+        report(1, "ERROR: %zu tasks never run, %zu run more than once", missed,
+               repeated);
+        goto out;
+    }
+    ok = true;
+
+out:
+    for (int i = 0; i < ndeques; i++)
+        wsq_free(deques[i]);
+    return ok;
+}
+
+static bool do_sched(int argc, char *argv[])
+{
+    int workers, depth;
+    if (argc != 3 || !get_int(argv[1], &workers) ||
+        !get_int(argv[2], &depth)) {
+        report(1, "%s takes arguments <workers> <depth>", argv[0]);
+        return false;
+    }
+    if (workers < 1 || workers > STRESS_MAX_THREADS || depth < 0 ||
+        depth > SCHED_MAX_DEPTH) {
+        report(1, "Need 1 to %d workers and a depth from 0 to %d",
+               STRESS_MAX_THREADS, SCHED_MAX_DEPTH);
+        return false;
+    }
+
+    sched_t s = {.ntasks = ((size_t) 2 << depth) - 1};
+    s.tasks = calloc(s.ntasks, sizeof(element_t));
+    s.seen = calloc(s.ntasks, sizeof(atomic_uchar));
+    if (!s.tasks || !s.seen) {
+        report(1, "ERROR: Could not allocate space for the task tree");
+        free(s.tasks);
+        free(s.seen);
+        return false;
+    }
+
+    /* From one worker up, doubling the count each time */
+    bool ok = true;
+    double base = 0;
+    for (int n = 1; ok; n = n < workers && 2 * n > workers ? workers : 2 * n) {
+        double secs;
+        size_t steals;
+        if (!(ok = sched_run(&s, n, &secs, &steals)))
+            break;
+        double rate = secs > 0 ? s.ntasks / secs : 0;
+        if (n == 1)
+            base = rate;
+        report(1,
+               "%d workers: %zu tasks in %.3f seconds, %.0f tasks/s, %zu "
+               "steals, %.2fx",
+               n, s.ntasks, secs, rate, steals, base > 0 ? rate / base : 0.0);
+        if (n == workers)
+            break;
+    }
+
+    free(s.tasks);
+    free(s.seen);
+    return ok && !error_check();
+}
+
+/* Default and largest number of nodes the prefetching benchmark walks */
+#define WALK_NODES 1000000
+#define WALK_MAX_NODES (1 << 24)
+
+/* Walks of each kind, the fastest one is reported */
+#define WALK_ROUNDS 3
+
+/* Storage of the string of each node */
+#define WALK_STRING 16
+
+/* Open a counter of the cache misses of this thread, -1 if there is none */
+static int walk_counter_open(void)
+{
+#if defined(__linux__)
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CACHE_MISSES,
+        .disabled = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/* Hash the string of @e into @h, the work a walk does on every node */
+static inline uint64_t walk_hash(uint64_t h, const element_t *e)
+{
+    for (const char *c = e->value; *c; c++)
+        h = h * 31 + (unsigned char) *c;
+    return h;
+}
+
+/* Hash every string of @head, with or without prefetching the nodes and the
+ * strings ahead
+ */
+static uint64_t walk_list(struct list_head *head, bool prefetch)
+{
+    uint64_t h = 0;
+    element_t *e;
+    if (prefetch) {
+        list_for_each_entry_prefetch (e, head, list) {
+            list_prefetch(list_entry(e->list.next, element_t, list)->value);
+            h = walk_hash(h, e);
+        }
+    } else {
+        list_for_each_entry (e, head, list)
+            h = walk_hash(h, e);
+    }
+    return h;
+}
+
+/* Walk @head WALK_ROUNDS times, keeping the time and the cache misses, -1 if
+ * not counted, of the fastest walk
+ */
+static uint64_t walk_measure(struct list_head *head,
+                             bool prefetch,
+                             int fd,
+                             double *secs,
+                             long long *misses)
+{
+    uint64_t sum = 0;
+    *secs = -1;
+    *misses = -1;
+    for (int r = 0; r < WALK_ROUNDS; r++) {
+        struct timespec begin, end;
+        long long count = -1;
+#if defined(__linux__)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        sum = walk_list(head, prefetch);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+#if defined(__linux__)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count))
+                count = -1;
+        }
+#endif
+        double t =
+            (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+        if (*secs < 0 || t < *secs) {
+            *secs = t;
+            *misses = count;
+        }
+    }
+    return sum;
+}
+
+static bool do_walk(int argc, char *argv[])
+{
+    int n = WALK_NODES;
+    if (argc > 2 || (argc == 2 && !get_int(argv[1], &n))) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (n < 1 || n > WALK_MAX_NODES) {
+        report(1, "Need 1 to %d nodes", WALK_MAX_NODES);
+        return false;
+    }
+
+    element_t *nodes = calloc(n, sizeof(element_t));
+    char *strs = malloc((size_t) n * WALK_STRING);
+    int *order = malloc(n * sizeof(int));
+    if (!nodes || !strs || !order) {
+        report(1, "ERROR: Could not allocate space for the nodes");
+        free(nodes);
+        free(strs);
+        free(order);
+        return false;
+    }
+
+    /* Link the nodes in a random order, so that each step of a walk lands
+     * on a cache line of its own as it does in a queue which was sorted.
+     * The head is an element too, so that the walks may look at the string
+     * after the last node.
+     */
+    element_t head = {.value = ""};
+    INIT_LIST_HEAD(&head.list);
+    uint32_t rnd = 2654435761U;
+    for (int i = 0; i < n; i++) {
+        int j = i ? rnd % (i + 1) : 0;
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 17;
+        rnd ^= rnd << 5;
+        order[i] = order[j];
+        order[j] = i;
+        memset(strs + (size_t) i * WALK_STRING, 'a' + i % 26, WALK_STRING - 1);
+        strs[(size_t) i * WALK_STRING + WALK_STRING - 1] = '\0';
+        nodes[i].value = strs + (size_t) i * WALK_STRING;
+    }
+    for (int i = 0; i < n; i++)
+        list_add_tail(&nodes[order[i]].list, &head.list);
+
+    int fd = walk_counter_open();
+    double secs[2];
+    long long misses[2];
+    uint64_t sum[2];
+    for (int p = 0; p < 2; p++) {
+        sum[p] = walk_measure(&head.list, p, fd, &secs[p], &misses[p]);
+        if (misses[p] < 0) {
+            report(1, "%s: %d nodes in %.3f seconds", p ? "prefetch" : "plain",
+                   n, secs[p]);
+        } else {
+            report(1, "%s: %d nodes in %.3f seconds, %lld cache misses",
+                   p ? "prefetch" : "plain", n, secs[p], misses[p]);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    else
+        report(1, "Cache misses are not counted on this system");
+
+    bool ok = sum[0] == sum[1];
+    if (!ok)
+        report(1, "ERROR: The walks read different strings");
+    else if (secs[1] > 0 && misses[0] > 0 && misses[1] >= 0)
+        report(1, "Prefetching: %.2fx speed, %.2fx cache misses",
+               secs[0] / secs[1], (double) misses[1] / misses[0]);
+    else if (secs[1] > 0)
+        report(1, "Prefetching: %.2fx speed", secs[0] / secs[1]);
+
+    free(nodes);
+    free(strs);
+    free(order);
+    return ok && !error_check();
+}
+
+#if !defined(QUEUE_CHUNK) && !defined(QUEUE_RING)
+/* Walk the links of the list backend independently of the code under test */
 static bool is_circular()
 {
     struct list_head *cur = current->q->next;
@@ -946,6 +1847,7 @@ static bool is_circular()
     }
     return true;
 }
+#endif
 
 static bool q_show(int vlevel)
 {
@@ -959,29 +1861,36 @@ static bool q_show(int vlevel)
         return true;
     }
 
+#if !defined(QUEUE_CHUNK) && !defined(QUEUE_RING)
     if (!is_circular()) {
         report(vlevel, "ERROR:  Queue is not doubly circular");
         return false;
     }
+#else
+    /* the elements are not linked, rely on the backend's own check */
+    if (!q_check(current->q)) {
+        report(vlevel, "ERROR:  Queue is corrupted");
+        return false;
+    }
+#endif
 
     report_noreturn(vlevel, "l = [");
 
-    struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    q_iter_t it;
+    element_t *e = q_iter_first(&it, current->q);
 
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < current->size) {
-            element_t *e = list_entry(cur, element_t, list);
+        while (ok && e && cnt < current->size) {
             if (cnt < BIG_LIST_SIZE) {
                 report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
                 if (show_entropy) {
                     report_noreturn(
                         vlevel, "(%3.2f%%)",
-                        shannon_entropy((const uint8_t *) e->value));
+                        shannon_entropy((const uint8_t *) e->value, e->len));
                 }
             }
             cnt++;
-            cur = cur->next;
+            e = q_iter_next(&it);
             ok = ok && !error_check();
         }
     }
@@ -992,7 +1901,7 @@ static bool q_show(int vlevel)
         return false;
     }
 
-    if (cur == ori) {
+    if (!e) {
         if (cnt <= BIG_LIST_SIZE)
             report(vlevel, "]");
         else
@@ -1066,6 +1975,15 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Restart the malloc failures, telling the seed to replay them with */
+static void malloc_setter(int oldval)
+{
+    (void) oldval;
+    fail_reset();
+    if (fail_probability > 0)
+        report(3, "Malloc failures seeded with %d", malloc_seed);
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1088,10 +2006,19 @@ static void console_init()
         rt,
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
+    ADD_COMMAND(ph,
+                "Remove from head of queue without copying the string. "
+                "Optionally compare to expected value str",
+                "[str]");
+    ADD_COMMAND(pt,
+                "Remove from tail of queue without copying the string. "
+                "Optionally compare to expected value str",
+                "[str]");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(mem, "Show memory statistics of the allocations", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
@@ -1106,14 +2033,35 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(stress,
+                "Pass elements from producer to consumer threads through a "
+                "lock-free queue",
+                "producers consumers ops");
+    ADD_COMMAND(sched,
+                "Run a task tree of the given depth on work-stealing workers, "
+                "from 1 up to the given number",
+                "workers depth");
+    ADD_COMMAND(walk,
+                "Walk a list of scattered nodes with and without prefetching",
+                "[n]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
-              NULL);
+              malloc_setter);
+    add_param("mallocseed", &malloc_seed,
+              "Seed of the malloc failures, picked at random if 0",
+              malloc_setter);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("memprofile", &mem_profile,
+              "Record where each allocation is made, reported by 'mem'", NULL);
+    add_param("intern", &intern_mode,
+              "Share one copy of identical strings among elements", NULL);
+    add_param("threads", &threads,
+              "Number of threads for parallel sort, all processors if 0",
+              NULL);
 }
 
 /* Signal handlers */
@@ -1146,8 +2094,6 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
@@ -1161,16 +2107,24 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+
+    mem_stats_t st;
+    mem_stats(&st);
+    mem_report(4, &st);
+
+    /* the last blocks freed are only checked once the harness lets go */
+    bool ok = mem_drain();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
                bcnt);
+        if (mem_profile)
+            mem_site_report(1);
         return false;
     }
 
-    return true;
+    return ok;
 }
 
 static void usage(char *cmd)
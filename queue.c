@@ -1,3 +1,4 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,14 +11,52 @@
  *   cppcheck-suppress nullPointer
  */
 
+/**
+ * queue_t - Header of a queue which keeps track of its length
+ * @head: the list head handed out by q_new()
+ * @size: number of elements linked to @head
+ * @mid: node of the element q_delete_mid() removes, the one at position
+ *       (@size - 1) / 2, or NULL if it is not known
+ * @slab: arena the elements of this queue are carved out of
+ *
+ * Every operation which links or unlinks elements keeps @size up to date, so
+ * q_size() never has to walk the list.  Inserting and removing at either end
+ * moves @mid by at most one node, depending on the parity of @size, which
+ * makes draining a queue from the middle take constant time per element.
+ * Operations reordering the whole queue forget @mid, and the next
+ * q_delete_mid() looks it up again.
+ */
+typedef struct {
+    struct list_head head;
+    int size;
+    struct list_head *mid;
+    slab_t slab;
+} queue_t;
+
+#define q_hdr(h) container_of(h, queue_t, head)
+
+/* Find the node at position (size - 1) / 2 with slow and fast pointers */
+static struct list_head *q_find_mid(struct list_head *head)
+{
+    struct list_head *slow = head->next, *fast = head->next->next;
+    while (fast != head && fast != head->prev) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    return slow;
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *li_new = malloc(sizeof(struct list_head));
-    if (!li_new)
+    queue_t *qu = malloc(sizeof(queue_t));
+    if (!qu)
         return NULL;
-    INIT_LIST_HEAD(li_new);
-    return li_new;
+    INIT_LIST_HEAD(&qu->head);
+    qu->size = 0;
+    qu->mid = NULL;
+    slab_init(&qu->slab);
+    return &qu->head;
 }
 
 /* Free all storage used by queue */
@@ -26,31 +65,61 @@ void q_free(struct list_head *head)
     if (!head)
         return;
 
-    /* traverse the queue and release the memory */
-    element_t *el = NULL, *el_safe;
-    list_for_each_entry_safe (el, el_safe, head, list) {
-        q_release_element(el);
+    queue_t *qu = q_hdr(head);
+    if (qu->slab.live == qu->size && !intern_refs()) {
+        /* no element has left the queue nor holds an interned string, drop
+         * the whole arena at once
+         */
+        slab_purge(&qu->slab);
+    } else {
+        /* traverse the queue and release the memory */
+        element_t *el = NULL, *el_safe;
+        list_for_each_entry_safe_prefetch (el, el_safe, head, list)
+            q_release_element(el);
     }
+    slab_destroy(&qu->slab);
 
-    free(head);
+    free(qu);
     return;
 }
 
-inline element_t *q_new_element(char *s)
+/* Initialize an element holding @s, whose length is @len, either in a copy of
+ * its own or in @shared, the copy held by the intern table, if not NULL
+ */
+static inline element_t *q_init_element(element_t *el,
+                                        char *s,
+                                        size_t len,
+                                        char *shared)
+{
+    el->value = shared ? shared : memcpy(el->data, s, len + 1);
+    el->key = q_key(s, len);
+    el->len = len;
+    return el;
+}
+
+/* Bytes taken by an element holding a string of length @len */
+static inline size_t q_element_size(size_t len)
+{
+    return sizeof(element_t) + (intern_mode ? 0 : len + 1);
+}
+
+static inline element_t *q_new_element(queue_t *qu, char *s)
 {
-    /* allocate the memory for the new element */
-    element_t *el = malloc(sizeof(element_t));
+    /* allocate the new element along with the storage of the string */
+    size_t len = strlen(s);
+    element_t *el = slab_alloc(&qu->slab, q_element_size(len));
     if (!el)
         return NULL;
 
-    /* initialize the new element */
-    el->value = strdup(s);
-    if (!el->value) {
-        free(el);
+    /* or share the copy in the intern table */
+    char *shared = NULL;
+    if (intern_mode && !(shared = intern_get(s, len))) {
+        slab_free(el);
         return NULL;
     }
 
-    return el;
+    /* initialize the new element */
+    return q_init_element(el, s, len, shared);
 }
 
 /* Insert an element at head of queue */
@@ -58,11 +127,18 @@ bool q_insert_head(struct list_head *head, char *s)
 {
     /* generate new element and handle exceptions */
     element_t *el;
-    if (!head || !s || !(el = q_new_element(s)))
+    if (!head || !s || !(el = q_new_element(q_hdr(head), s)))
         return false;
 
-    /* insert the new element at the head of the queue */
+    /* insert the new element at the head of the queue, the middle moves
+     * one node towards it if the size becomes even
+     */
+    queue_t *qu = q_hdr(head);
     list_add(&el->list, head);
+    if (++qu->size == 1)
+        qu->mid = &el->list;
+    else if (qu->mid && !(qu->size & 1))
+        qu->mid = qu->mid->prev;
 
     return true;
 }
@@ -72,65 +148,188 @@ bool q_insert_tail(struct list_head *head, char *s)
 {
     /* generate new element and handle exceptions */
     element_t *el;
-    if (!head || !s || !(el = q_new_element(s)))
+    if (!head || !s || !(el = q_new_element(q_hdr(head), s)))
         return false;
 
-    /* insert the new element at the tail of the queue */
+    /* insert the new element at the tail of the queue, the middle moves
+     * one node towards it if the size becomes odd
+     */
+    queue_t *qu = q_hdr(head);
     list_add_tail(&el->list, head);
+    if (++qu->size == 1)
+        qu->mid = &el->list;
+    else if (qu->mid && (qu->size & 1))
+        qu->mid = qu->mid->next;
 
     return true;
 }
 
-inline void q_copy_string(char *dst, char *src, size_t bufsize)
+/* Allocate the elements of a batch from a single chunk and link them up in
+ * the order of @s, or in reverse order if @reverse is set
+ */
+static bool q_new_batch(queue_t *qu,
+                        struct list_head *batch,
+                        char **s,
+                        size_t n,
+                        bool reverse)
 {
-    /* copy the content to dst if dst is non-NULL */
-    if (dst) {
-        strncpy(dst, src, bufsize - 1);
-        dst[bufsize - 1] = '\0';
+    if (!s)
+        return false;
+
+    /* size the chunk holding all the elements and their strings */
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!s[i])
+            return false;
+        bytes += slab_size(q_element_size(strlen(s[i])));
+    }
+
+    if (intern_mode && !intern_get_many(s, n))
+        return false;
+
+    slab_batch_t cursor;
+    if (!slab_alloc_batch(&qu->slab, &cursor, bytes, n)) {
+        if (intern_mode)
+            intern_put_many(s, n);
+        return false;
+    }
+
+    INIT_LIST_HEAD(batch);
+    char *shared = NULL;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(s[i]);
+        if (intern_mode && (!i || s[i] != s[i - 1]))
+            shared = intern_find(s[i], len);
+        element_t *el = slab_batch_next(&cursor, q_element_size(len));
+        q_init_element(el, s[i], len, shared);
+        if (reverse)
+            list_add(&el->list, batch);
+        else
+            list_add_tail(&el->list, batch);
+    }
+    return true;
+}
+
+/* Insert a batch of elements at head of queue */
+bool q_insert_head_many(struct list_head *head, char **s, size_t n)
+{
+    if (!head)
+        return false;
+    if (!n)
+        return true;
+
+    /* the last string ends up at the head, as with repeated q_insert_head */
+    LIST_HEAD(batch);
+    if (!q_new_batch(q_hdr(head), &batch, s, n, true))
+        return false;
+
+    list_splice(&batch, head);
+    q_hdr(head)->size += n;
+    q_hdr(head)->mid = NULL;
+
+    return true;
+}
+
+/* Insert a batch of elements at tail of queue */
+bool q_insert_tail_many(struct list_head *head, char **s, size_t n)
+{
+    if (!head)
+        return false;
+    if (!n)
+        return true;
+
+    LIST_HEAD(batch);
+    if (!q_new_batch(q_hdr(head), &batch, s, n, false))
+        return false;
+
+    list_splice_tail(&batch, head);
+    q_hdr(head)->size += n;
+    q_hdr(head)->mid = NULL;
+
+    return true;
+}
+
+static inline void q_copy_string(char *dst,
+                                 const element_t *el,
+                                 size_t bufsize)
+{
+    /* copy the content to dst if dst is non-NULL, only as many bytes as the
+     * string holds rather than padding the whole buffer as strncpy() would
+     */
+    if (dst && bufsize) {
+        size_t len = el->len < bufsize - 1 ? el->len : bufsize - 1;
+        memcpy(dst, el->value, len);
+        dst[len] = '\0';
     }
     return;
 }
 
-/* Remove an element from head of queue */
-element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+/* Remove an element from head of queue without copying its string */
+element_t *q_pop_head(struct list_head *head)
 {
     if (!head || list_empty(head))
         return NULL;
 
-    /* extract the element from the head of the queue */
+    /* extract the element from the head of the queue, the middle moves one
+     * node away from it if the size was even
+     */
+    queue_t *qu = q_hdr(head);
     element_t *el = list_first_entry(head, element_t, list);
+    if (qu->size == 1)
+        qu->mid = NULL;
+    else if (qu->mid && !(qu->size & 1))
+        qu->mid = qu->mid->next;
     list_del(head->next);
-
-    q_copy_string(sp, el->value, bufsize);
+    qu->size--;
 
     return el;
 }
 
-/* Remove an element from tail of queue */
-element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+/* Remove an element from tail of queue without copying its string */
+element_t *q_pop_tail(struct list_head *head)
 {
     if (!head || list_empty(head))
         return NULL;
 
-    /* extract the element from the tail of the queue */
+    /* extract the element from the tail of the queue, the middle moves one
+     * node away from it if the size was odd
+     */
+    queue_t *qu = q_hdr(head);
     element_t *el = list_last_entry(head, element_t, list);
+    if (qu->size == 1)
+        qu->mid = NULL;
+    else if (qu->mid && (qu->size & 1))
+        qu->mid = qu->mid->prev;
     list_del(head->prev);
+    qu->size--;
+
+    return el;
+}
 
-    q_copy_string(sp, el->value, bufsize);
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *el = q_pop_head(head);
+    if (el)
+        q_copy_string(sp, el, bufsize);
+    return el;
+}
 
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *el = q_pop_tail(head);
+    if (el)
+        q_copy_string(sp, el, bufsize);
     return el;
 }
 
 /* Return number of elements in queue */
 int q_size(struct list_head *head)
 {
-    if (!head || list_empty(head))
+    if (!head)
         return 0;
-    int len = 0;
-    struct list_head *li;
-    list_for_each (li, head)
-        ++len;
-    return len;
+    return q_hdr(head)->size;
 }
 
 /* Delete the middle node in queue */
@@ -138,47 +337,95 @@ bool q_delete_mid(struct list_head *head)
 {
     if (!head || list_empty(head))
         return false;
-    struct list_head *slow = head->next, *fast = head->next->next;
-    while (fast != head && fast != head->prev) {
-        slow = slow->next;
-        fast = fast->next->next;
-    }
-    list_del(slow);
-    element_t *el = list_entry(slow, element_t, list);
+
+    /* the next middle is the successor of this one if the size was even,
+     * otherwise its predecessor
+     */
+    queue_t *qu = q_hdr(head);
+    struct list_head *mid = qu->mid ? qu->mid : q_find_mid(head);
+    if (qu->size == 1)
+        qu->mid = NULL;
+    else
+        qu->mid = qu->size & 1 ? mid->prev : mid->next;
+    list_del(mid);
+    qu->size--;
+    element_t *el = list_entry(mid, element_t, list);
     q_release_element(el);
     return true;
 }
 
-#define list_for_each_safe_partial(node, safe, start, end)       \
-    for (node = (start)->next, safe = node->next; node != (end); \
-         node = safe, safe = node->next)
+/* Number of buckets of the scratch table used by q_delete_dup() */
+#define DEDUP_HASH_BITS 16
+
+/* The buckets chain the first element seen with each string through the prev
+ * links of the list, which q_delete_dup() rebuilds afterwards.  The table is
+ * left empty after every call and reused, so deleting duplicates does not
+ * allocate anything.
+ */
+static struct list_head *dedup_table[1 << DEDUP_HASH_BITS];
+
+/* Tag in a prev link telling that the string of the node occurs again */
+#define DEDUP_MARK ((uintptr_t) 1)
+
+#define dedup_link(li) \
+    ((struct list_head *) ((uintptr_t) (li)->prev & ~DEDUP_MARK))
+
+/* FNV-1a hash of the string of an element, folded to the size of the table */
+static inline uint32_t dedup_hash(const element_t *el)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < el->len; i++) {
+        h ^= (unsigned char) el->value[i];
+        h *= 16777619u;
+    }
+    return (h ^ (h >> DEDUP_HASH_BITS)) & ((1 << DEDUP_HASH_BITS) - 1);
+}
 
 /* Delete all nodes that have duplicate string */
 bool q_delete_dup(struct list_head *head)
 {
     if (!head || list_empty(head))
         return false;
-    struct list_head *left, *left_safe;
-    list_for_each_safe (left, left_safe, head) {
-        element_t *el_left = list_entry(left, element_t, list);
-        bool has = false;
-        struct list_head *right, *right_safe;
-        list_for_each_safe_partial(right, right_safe, left, head)
-        {
-            element_t *el_right = list_entry(right, element_t, list);
-            if (!strcmp(el_left->value, el_right->value)) {
-                has = true;
-                list_del(&el_right->list);
-                q_release_element(el_right);
-            }
+    queue_t *qu = q_hdr(head);
+    struct list_head *li, *safe, *prev;
+
+    /* first pass: find out which strings occur more than once */
+    for (li = head->next; li != head; li = li->next) {
+        const element_t *el = list_entry(li, element_t, list);
+        struct list_head **bucket = &dedup_table[dedup_hash(el)];
+        struct list_head *first = *bucket;
+        while (first && q_compare(list_entry(first, element_t, list), el))
+            first = dedup_link(first);
+        if (first) {
+            first->prev = (struct list_head *) ((uintptr_t) first->prev |
+                                                DEDUP_MARK);
+            li->prev = (struct list_head *) DEDUP_MARK;
+        } else {
+            li->prev = *bucket;
+            *bucket = li;
         }
-        /* it is necessary to reassign the value of safe var */
-        left_safe = left->next;
-        if (has) {
-            list_del(left);
-            q_release_element(el_left);
+    }
+
+    /* second pass: drop the marked nodes, empty the table and rebuild the
+     * prev links
+     */
+    prev = head;
+    for (li = head->next; li != head; li = safe) {
+        element_t *el = list_entry(li, element_t, list);
+        safe = li->next;
+        dedup_table[dedup_hash(el)] = NULL;
+        if ((uintptr_t) li->prev & DEDUP_MARK) {
+            q_release_element(el);
+            qu->size--;
+        } else {
+            li->prev = prev;
+            prev->next = li;
+            prev = li;
         }
     }
+    prev->next = head;
+    head->prev = prev;
+    qu->mid = NULL;
     return true;
 }
 
@@ -195,17 +442,29 @@ void q_swap(struct list_head *head)
         x = y;                      \
         y = SWAP;                   \
     } while (0)
-/* Reverse elements in queue */
-void q_reverse(struct list_head *head)
+/* Reverse a list which need not be the head of a queue */
+static void list_reverse(struct list_head *head)
 {
-    if (!head || list_empty(head))
-        return;
-
     struct list_head *li, *li_safe;
     list_for_each_safe (li, li_safe, head) {
         list_swap_t(li->prev, li->next);
     }
     list_swap_t(head->prev, head->next);
+}
+
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return;
+
+    /* with an even size the middle moves to the node after it, which is
+     * before it once reversed
+     */
+    queue_t *qu = q_hdr(head);
+    if (qu->mid && !(qu->size & 1))
+        qu->mid = qu->mid->next;
+    list_reverse(head);
     return;
 }
 
@@ -230,12 +489,13 @@ void q_reverseK(struct list_head *head, int k)
             list_add(li, &cache);
         }
         if (!check)
-            q_reverse(&cache);
+            list_reverse(&cache);
         list_splice_tail(&cache, &dummy_head);
         INIT_LIST_HEAD(&cache);
     }
     list_add(head, &dummy_head);
     list_del(&dummy_head);
+    q_hdr(head)->mid = NULL;
 }
 
 /* ensure that head, left, right are non-NULL pointer */
@@ -247,9 +507,12 @@ void merge2sorted(struct list_head *head,
     while (!list_empty(left) && !list_empty(right)) {
         const element_t *el1 = list_first_entry(left, element_t, list);
         const element_t *el2 = list_first_entry(right, element_t, list);
-        int c = strcmp(el1->value, el2->value);
-        struct list_head *li = descend ? (c < 0 ? left->next : right->next)
-                                       : (c > 0 ? right->next : left->next);
+        int c = q_compare(el1, el2);
+        /* take the left one on ties to keep the sort stable */
+        struct list_head *li = (descend ? c < 0 : c > 0) ? right->next
+                                                         : left->next;
+        /* the successor of li is compared next, load the one after it */
+        list_prefetch(li->next->next);
         list_del(li);
         list_add_tail(li, head);
     }
@@ -284,6 +547,8 @@ void merge_sort(struct list_head *head, bool descend)
 /* Sort elements of queue in ascending/descending order */
 void q_sort(struct list_head *head, bool descend)
 {
+    if (head)
+        q_hdr(head)->mid = NULL;
     return merge_sort(head, descend);
 }
 
@@ -298,16 +563,18 @@ int q_strict(struct list_head *head, int descend)
     if (!head || list_empty(head) || list_is_singular(head))
         return q_size(head);
     element_t *el = NULL, *el_safe;
-    const char dummy[1] = "", *s = dummy;
+    const element_t *last = NULL;
     int len = 0;
     list_for_each_entry_safe_reverse(el, el_safe, head, list)
     {
-        if (strcmp(el->value, s) * descend > 0) {
+        if (last && q_compare(el, last) * descend > 0) {
             list_del(&el->list);
             q_release_element(el);
         } else
-            s = el->value, ++len;
+            last = el, ++len;
     }
+    q_hdr(head)->size = len;
+    q_hdr(head)->mid = NULL;
     return len;
 }
 
@@ -325,19 +592,65 @@ int q_descend(struct list_head *head)
     return q_strict(head, -1);
 }
 
-void merge2queue(struct list_head *left, struct list_head *right, bool descend)
+/* Most queues merged in one round of q_merge() */
+#define MERGE_FANIN 1024
+
+/**
+ * merge_src_t - Queue taking part in a k-way merge
+ * @qu: the queue, whose first element is the next one it contributes
+ * @order: position of the queue in the chain, breaking ties between equal
+ *         elements so that the merge is stable
+ */
+typedef struct {
+    queue_t *qu;
+    int order;
+} merge_src_t;
+
+/* Whether the next element of @a goes out before the one of @b */
+static inline bool merge_before(const merge_src_t *a,
+                                const merge_src_t *b,
+                                bool descend)
+{
+    int c = q_compare(list_first_entry(&a->qu->head, element_t, list),
+                      list_first_entry(&b->qu->head, element_t, list));
+    if (!c)
+        return a->order < b->order;
+    return descend ? c > 0 : c < 0;
+}
+
+static void merge_sift_down(merge_src_t *heap, int n, int i, bool descend)
 {
-    queue_contex_t *qu_l = list_entry(left, queue_contex_t, chain);
-    queue_contex_t *qu_r = list_entry(right, queue_contex_t, chain);
-    /* merge list to the dummy head */
-    LIST_HEAD(dummy);
-    merge2sorted(&dummy, qu_l->q, qu_r->q, descend);
-    /* replace the dummy head with the head of the left queue */
-    list_add(qu_l->q, &dummy);
-    list_del(&dummy);
-    /* make the queue be empty */
-    INIT_LIST_HEAD(qu_r->q);
-    return;
+    merge_src_t src = heap[i];
+    for (int child; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n &&
+            merge_before(&heap[child + 1], &heap[child], descend))
+            child++;
+        if (!merge_before(&heap[child], &src, descend))
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = src;
+}
+
+/* Merge the @n non-empty queues of @heap into @out through a binary heap
+ * keyed on their first elements, moving every element exactly once.
+ */
+static void merge_heap(struct list_head *out,
+                       merge_src_t *heap,
+                       int n,
+                       bool descend)
+{
+    for (int i = n / 2 - 1; i >= 0; i--)
+        merge_sift_down(heap, n, i, descend);
+
+    while (n) {
+        queue_t *qu = heap[0].qu;
+        list_prefetch(qu->head.next->next->next);
+        list_move_tail(qu->head.next, out);
+        if (list_empty(&qu->head))
+            heap[0] = heap[--n];
+        merge_sift_down(heap, n, 0, descend);
+    }
 }
 
 /* Merge all the queues into one sorted queue, which is in ascending/descending
@@ -347,12 +660,126 @@ int q_merge(struct list_head *head, bool descend)
     /* handle the basic case */
     if (!head || list_empty(head))
         return 0;
-    /* naive approach to merge queue */
+
+    queue_contex_t *ctx = list_first_entry(head, queue_contex_t, chain);
+    if (!ctx->q)
+        return 0;
+    queue_t *first = q_hdr(ctx->q);
+
+    /* Merge up to MERGE_FANIN queues at a time into the first one, which
+     * takes over the elements and the arenas of the others.
+     */
+    merge_src_t heap[MERGE_FANIN];
     struct list_head *li = head->next->next;
     while (li != head) {
-        merge2queue(head->next, li, descend);
-        li = li->next;
+        LIST_HEAD(out);
+        int n = 0, total = first->size;
+        if (first->size) {
+            heap[n].qu = first;
+            heap[n].order = n;
+            n++;
+        }
+        for (; li != head && n < MERGE_FANIN; li = li->next) {
+            ctx = list_entry(li, queue_contex_t, chain);
+            if (!ctx->q)
+                continue;
+            queue_t *qu = q_hdr(ctx->q);
+            if (qu->size) {
+                heap[n].qu = qu;
+                heap[n].order = n;
+                n++;
+            }
+            total += qu->size;
+            qu->size = 0;
+            qu->mid = NULL;
+            slab_merge(&first->slab, &qu->slab);
+        }
+        merge_heap(&out, heap, n, descend);
+        list_splice(&out, &first->head);
+        first->size = total;
+        first->mid = NULL;
+    }
+    return first->size;
+}
+
+/* Set aside room for n elements, which a list never needs */
+bool q_reserve(struct list_head *head, int n)
+{
+    return head != NULL;
+}
+
+/* Point @it at @li, which is past the end once it comes back to the head */
+static inline element_t *q_iter_at(q_iter_t *it, struct list_head *li)
+{
+    it->pos = li;
+    return li == it->head ? NULL : list_entry(li, element_t, list);
+}
+
+element_t *q_iter_first(q_iter_t *it, struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    it->head = head;
+    return q_iter_at(it, head->next);
+}
+
+element_t *q_iter_last(q_iter_t *it, struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    it->head = head;
+    return q_iter_at(it, head->prev);
+}
+
+element_t *q_iter_next(q_iter_t *it)
+{
+    /* a forward walk usually reads the strings too, as q_show() does, so
+     * load the node after the next one and the string of the next one
+     */
+    struct list_head *li = it->pos->next;
+    list_prefetch(li->next->next);
+    if (li->next != it->head)
+        list_prefetch(list_entry(li->next, element_t, list)->value);
+    return q_iter_at(it, li);
+}
+
+element_t *q_iter_prev(q_iter_t *it)
+{
+    return q_iter_at(it, it->pos->prev);
+}
+
+/* The elements already are a list, lend it out as is and keep the size */
+void q_detach(struct list_head *head, struct list_head *list)
+{
+    list_splice_init(head, list);
+    q_hdr(head)->mid = NULL;
+}
+
+void q_attach(struct list_head *head, struct list_head *list)
+{
+    list_splice_init(list, head);
+}
+
+bool q_check(struct list_head *head)
+{
+    if (!head)
+        return true;
+
+    /* every node must be the prev of its next, which also covers the prev
+     * links, and the walk must come back to the head after exactly size
+     * elements, passing the tracked middle if there is one at its position
+     */
+    const queue_t *qu = q_hdr(head);
+    int size = qu->size, n = 0;
+    for (struct list_head *li = head;; li = li->next) {
+        if (!li->next || li->next->prev != li)
+            return false;
+        if (li->next == head)
+            break;
+        if (qu->mid && (li->next == qu->mid) != (n == (size - 1) / 2))
+            return false;
+        if (++n > size)
+            return false;
     }
-    queue_contex_t *qu = list_first_entry(head, queue_contex_t, chain);
-    return q_size(qu->q);
+    return n == size;
 }
@@ -5,26 +5,90 @@
  * operations.
  *
  * It uses a circular doubly-linked list to represent the set of queue elements
+ * by default, an unrolled list of chunks of element pointers when built with
+ * QUEUE=chunk, or a growable ring buffer of element pointers with QUEUE=ring.
+ * Code outside the queue implementation walks the elements with the
+ * q_iter_*() functions, which work the same on all of them.
  */
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "harness.h"
+#include "intern.h"
 #include "list.h"
+#include "slab.h"
 
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
- *
- * @value needs to be explicitly allocated and freed
+ * @key: first 8 bytes of the string in big-endian order, zero padded
+ * @len: length of the string, excluding the null terminator
+ * @data: storage of the string, allocated along with the element
+ *
+ * @value points to @data, thus an element and its string are obtained by a
+ * single allocation and released as a whole.  Elements are carved out of the
+ * slab arena of the queue they are inserted into.  In interning mode @data is
+ * left empty and @value points at the copy shared through the intern table.
+ *
+ * Comparing @key as integers orders elements the same way as strcmp() does
+ * on their first 8 bytes, so most comparisons never touch the string.  With
+ * @len recorded at insertion, the string is never scanned for its end again.
  */
 typedef struct {
     char *value;
     struct list_head list;
+    uint64_t key;
+    size_t len;
+    char data[];
 } element_t;
 
+/**
+ * q_key() - Pack the first 8 bytes of a string into a comparison key
+ * @s: the string
+ * @len: length of @s, excluding the null terminator
+ *
+ * Return: the key to be stored in element_t.key
+ */
+static inline uint64_t q_key(const char *s, size_t len)
+{
+    uint64_t key = 0;
+    memcpy(&key, s, len < sizeof(key) ? len : sizeof(key));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    key = __builtin_bswap64(key);
+#endif
+    return key;
+}
+
+/**
+ * q_compare() - Compare the strings of two elements
+ * @a: an element
+ * @b: another element
+ *
+ * Return: less than, equal to, or greater than zero, as strcmp() would on the
+ * strings of @a and @b
+ */
+static inline int q_compare(const element_t *a, const element_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    /* the strings are equal if they both end within the key */
+    if (!(a->key & 0xff))
+        return 0;
+    /* both are at least as long as the key, compare the rest up to the end
+     * of the shorter one, which then goes first
+     */
+    size_t n = a->len < b->len ? a->len : b->len;
+    int c = memcmp(a->value + sizeof(a->key), b->value + sizeof(b->key),
+                   n - sizeof(a->key));
+    if (c)
+        return c;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -78,6 +142,35 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_many() - Insert a batch of elements in the head
+ * @head: header of queue
+ * @s: array of strings would be inserted
+ * @n: number of strings in @s
+ *
+ * Same as calling q_insert_head() on @s[0] through @s[n - 1] in turn, thus
+ * @s[n - 1] ends up at the head. The elements and their strings are obtained
+ * by a single allocation and linked in at once. Either all the strings are
+ * inserted or none of them.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_many(struct list_head *head, char **s, size_t n);
+
+/**
+ * q_insert_tail_many() - Insert a batch of elements at the tail
+ * @head: header of queue
+ * @s: array of strings would be inserted
+ * @n: number of strings in @s
+ *
+ * Same as calling q_insert_tail() on @s[0] through @s[n - 1] in turn. The
+ * elements and their strings are obtained by a single allocation and linked
+ * in at once. Either all the strings are inserted or none of them.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_many(struct list_head *head, char **s, size_t n);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -85,7 +178,8 @@ bool q_insert_tail(struct list_head *head, char *s);
  * @bufsize: size of the string
  *
  * If sp is non-NULL and an element is removed, copy the removed string to *sp
- * (up to a maximum of bufsize-1 characters, plus a null terminator.)
+ * (up to a maximum of bufsize-1 characters, plus a null terminator.)  Only
+ * the bytes of the string are written, the rest of *sp is left untouched.
  *
  * NOTE: "remove" is different from "delete"
  * The space used by the list element and the string should not be freed.
@@ -108,6 +202,26 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_pop_head() - Remove the element from head of queue without copying
+ * @head: header of queue
+ *
+ * The string is handed over along with the element, which holds it, so
+ * nothing is copied.  The caller reads it through the value member and
+ * releases both with q_release_element().
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or empty.
+ */
+element_t *q_pop_head(struct list_head *head);
+
+/**
+ * q_pop_tail() - Remove the element from tail of queue without copying
+ * @head: header of queue
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or empty.
+ */
+element_t *q_pop_tail(struct list_head *head);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
@@ -116,8 +230,10 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
-    test_free(e);
+    /* a string not stored along with the element is an interned one */
+    if (e->value != e->data)
+        intern_put(e->value);
+    slab_free(e);
 }
 
 /**
@@ -252,4 +368,96 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head, bool descend);
 
+/**
+ * q_reserve() - Set aside room for a number of elements
+ * @head: header of queue
+ * @n: number of elements queue should be able to hold
+ *
+ * The ring buffer backend needs room for all the elements of a chain in the
+ * first queue before q_merge() runs, since q_merge() may not allocate.  The
+ * other backends have nothing to set aside.
+ *
+ * Return: true for success, false if queue is NULL or allocation failed
+ */
+bool q_reserve(struct list_head *head, int n);
+
+/* Backend-independent access to the elements */
+
+/**
+ * q_iter_t - Cursor over the elements of a queue
+ * @head: header of queue
+ * @pos: node of the element under the cursor, or of the chunk holding it
+ * @idx: slot of the element within the chunk, or its position in the ring
+ *       buffer, unused by the list backend
+ *
+ * The queue must not be modified while a cursor walks it.
+ */
+typedef struct {
+    struct list_head *head;
+    struct list_head *pos;
+    int idx;
+} q_iter_t;
+
+/**
+ * q_iter_first() - Point a cursor at the first element of a queue
+ * @it: the cursor
+ * @head: header of queue
+ *
+ * Return: the first element, NULL if queue is NULL or empty
+ */
+element_t *q_iter_first(q_iter_t *it, struct list_head *head);
+
+/**
+ * q_iter_last() - Point a cursor at the last element of a queue
+ * @it: the cursor
+ * @head: header of queue
+ *
+ * Return: the last element, NULL if queue is NULL or empty
+ */
+element_t *q_iter_last(q_iter_t *it, struct list_head *head);
+
+/**
+ * q_iter_next() - Move a cursor to the next element
+ * @it: the cursor, pointing at an element
+ *
+ * Return: the next element, NULL if the cursor was at the last one
+ */
+element_t *q_iter_next(q_iter_t *it);
+
+/**
+ * q_iter_prev() - Move a cursor to the previous element
+ * @it: the cursor, pointing at an element
+ *
+ * Return: the previous element, NULL if the cursor was at the first one
+ */
+element_t *q_iter_prev(q_iter_t *it);
+
+/**
+ * q_detach() - Lend out all elements of a queue as a list
+ * @head: header of queue
+ * @list: empty list the elements are moved onto, linked through their list
+ *        member
+ *
+ * Lets list algorithms such as list_sort() run on either backend.  The queue
+ * must not be used until q_attach() gives the elements back.  Neither
+ * function allocates.
+ */
+void q_detach(struct list_head *head, struct list_head *list);
+
+/**
+ * q_attach() - Take back the elements lent out by q_detach()
+ * @head: header of queue
+ * @list: the elements, possibly reordered, in the order to store them
+ */
+void q_attach(struct list_head *head, struct list_head *list);
+
+/**
+ * q_check() - Verify the internal structure of a queue
+ * @head: header of queue
+ *
+ * Return: false if the links of queue are broken or the number of elements
+ * reachable does not match q_size()
+ */
+bool q_check(struct list_head *head);
+
 #endif /* LAB0_QUEUE_H */
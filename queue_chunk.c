@@ -0,0 +1,857 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "intern.h"
+#include "list.h"
+#include "list_sort.h"
+#include "queue.h"
+
+/* Queue backend storing the element pointers in chunks, built with
+ * QUEUE=chunk.  Walking a queue reads the pointers of Q_CHUNK_SLOTS elements
+ * from a single chunk instead of following one link per element, and the
+ * loads of the elements themselves no longer depend on each other.
+ */
+
+/* Element pointers per chunk */
+#define Q_CHUNK_SLOTS 64
+
+/* Empty chunks kept around for reuse once elements are removed */
+#define Q_MAX_SPARES 2
+
+/**
+ * q_chunk_t - Run of consecutive elements of a queue
+ * @list: node in the chunk list of the queue, or in its list of spares
+ * @first: slot of the first element
+ * @count: number of elements, in slots @first to @first + @count - 1
+ * @slot: pointers to the elements
+ *
+ * Every chunk linked to the queue holds at least one element.
+ */
+typedef struct {
+    struct list_head list;
+    int first, count;
+    element_t *slot[Q_CHUNK_SLOTS];
+} q_chunk_t;
+
+/**
+ * queue_t - Header of a queue stored as an unrolled list
+ * @head: the list head handed out by q_new(), linking the chunks in use
+ * @size: number of elements in the queue
+ * @slab: arena the elements of this queue are carved out of
+ * @spares: empty chunks ready to be reused
+ * @nspares: number of chunks in @spares
+ *
+ * Operations which may neither allocate nor free, like sorting and merging,
+ * park the chunks they empty in @spares.
+ */
+typedef struct {
+    struct list_head head;
+    int size;
+    slab_t slab;
+    struct list_head spares;
+    int nspares;
+} queue_t;
+
+#define q_hdr(h) container_of(h, queue_t, head)
+
+#define chunk_of(li) list_entry(li, q_chunk_t, list)
+
+/* Take a chunk from the spares or allocate one */
+static q_chunk_t *chunk_get(queue_t *qu)
+{
+    q_chunk_t *c;
+    if (qu->nspares) {
+        c = chunk_of(qu->spares.next);
+        list_del(&c->list);
+        qu->nspares--;
+    } else if (!(c = malloc(sizeof(q_chunk_t)))) {
+        return NULL;
+    }
+    c->count = 0;
+    return c;
+}
+
+/* Make sure the next @n chunks needed are at hand */
+static bool chunk_reserve(queue_t *qu, int n)
+{
+    while (qu->nspares < n) {
+        q_chunk_t *c = malloc(sizeof(q_chunk_t));
+        if (!c)
+            return false;
+        list_add(&c->list, &qu->spares);
+        qu->nspares++;
+    }
+    return true;
+}
+
+/* Park an emptied chunk among the spares, never freeing it */
+static inline void chunk_stash(queue_t *qu, q_chunk_t *c)
+{
+    list_move(&c->list, &qu->spares);
+    qu->nspares++;
+}
+
+/* Retire an emptied chunk, freeing it if there are spares enough */
+static void chunk_drop(queue_t *qu, q_chunk_t *c)
+{
+    if (qu->nspares < Q_MAX_SPARES) {
+        chunk_stash(qu, c);
+    } else {
+        list_del(&c->list);
+        free(c);
+    }
+}
+
+/* Create an empty queue */
+struct list_head *q_new()
+{
+    queue_t *qu = malloc(sizeof(queue_t));
+    if (!qu)
+        return NULL;
+    INIT_LIST_HEAD(&qu->head);
+    qu->size = 0;
+    slab_init(&qu->slab);
+    INIT_LIST_HEAD(&qu->spares);
+    qu->nspares = 0;
+    return &qu->head;
+}
+
+/* Free all storage used by queue */
+void q_free(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    queue_t *qu = q_hdr(head);
+    q_chunk_t *c, *safe;
+    if (qu->slab.live == qu->size && !intern_refs()) {
+        /* no element has left the queue nor holds an interned string, drop
+         * the whole arena at once
+         */
+        slab_purge(&qu->slab);
+    } else {
+        list_for_each_entry (c, head, list) {
+            for (int i = c->first; i < c->first + c->count; i++)
+                q_release_element(c->slot[i]);
+        }
+    }
+    slab_destroy(&qu->slab);
+
+    list_splice_init(&qu->spares, head);
+    list_for_each_entry_safe (c, safe, head, list)
+        free(c);
+    free(qu);
+}
+
+/* Initialize an element holding @s, whose length is @len, either in a copy of
+ * its own or in @shared, the copy held by the intern table, if not NULL
+ */
+static inline element_t *q_init_element(element_t *el,
+                                        char *s,
+                                        size_t len,
+                                        char *shared)
+{
+    el->value = shared ? shared : memcpy(el->data, s, len + 1);
+    el->key = q_key(s, len);
+    el->len = len;
+    return el;
+}
+
+/* Bytes taken by an element holding a string of length @len */
+static inline size_t q_element_size(size_t len)
+{
+    return sizeof(element_t) + (intern_mode ? 0 : len + 1);
+}
+
+static inline element_t *q_new_element(queue_t *qu, char *s)
+{
+    size_t len = strlen(s);
+    element_t *el = slab_alloc(&qu->slab, q_element_size(len));
+    if (!el)
+        return NULL;
+
+    char *shared = NULL;
+    if (intern_mode && !(shared = intern_get(s, len))) {
+        slab_free(el);
+        return NULL;
+    }
+    return q_init_element(el, s, len, shared);
+}
+
+/* Store @el in front of the first element, false for allocation failed */
+static bool q_push_head(queue_t *qu, element_t *el)
+{
+    q_chunk_t *c = list_empty(&qu->head) ? NULL : chunk_of(qu->head.next);
+    if (!c || !c->first) {
+        if (!(c = chunk_get(qu)))
+            return false;
+        c->first = Q_CHUNK_SLOTS;
+        list_add(&c->list, &qu->head);
+    }
+    c->slot[--c->first] = el;
+    c->count++;
+    qu->size++;
+    return true;
+}
+
+/* Store @el after the last element, false for allocation failed */
+static bool q_push_tail(queue_t *qu, element_t *el)
+{
+    q_chunk_t *c = list_empty(&qu->head) ? NULL : chunk_of(qu->head.prev);
+    if (!c || c->first + c->count == Q_CHUNK_SLOTS) {
+        if (!(c = chunk_get(qu)))
+            return false;
+        c->first = 0;
+        list_add_tail(&c->list, &qu->head);
+    }
+    c->slot[c->first + c->count++] = el;
+    qu->size++;
+    return true;
+}
+
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    element_t *el;
+    if (!head || !s || !(el = q_new_element(q_hdr(head), s)))
+        return false;
+    if (!q_push_head(q_hdr(head), el)) {
+        q_release_element(el);
+        return false;
+    }
+    return true;
+}
+
+/* Insert an element at tail of queue */
+bool q_insert_tail(struct list_head *head, char *s)
+{
+    element_t *el;
+    if (!head || !s || !(el = q_new_element(q_hdr(head), s)))
+        return false;
+    if (!q_push_tail(q_hdr(head), el)) {
+        q_release_element(el);
+        return false;
+    }
+    return true;
+}
+
+/* Allocate the elements of a batch from a single chunk of the arena and push
+ * them in the order of @s at the tail, or at the head if @tail is not set
+ */
+static bool q_insert_many(queue_t *qu, char **s, size_t n, bool tail)
+{
+    if (!s)
+        return false;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!s[i])
+            return false;
+        bytes += slab_size(q_element_size(strlen(s[i])));
+    }
+
+    /* reserve the chunks up front so that no push fails half-way */
+    size_t room = 0;
+    if (!list_empty(&qu->head)) {
+        q_chunk_t *c = chunk_of(tail ? qu->head.prev : qu->head.next);
+        room = tail ? Q_CHUNK_SLOTS - c->first - c->count : c->first;
+    }
+    if (n > room &&
+        !chunk_reserve(qu, (n - room + Q_CHUNK_SLOTS - 1) / Q_CHUNK_SLOTS))
+        return false;
+
+    if (intern_mode && !intern_get_many(s, n))
+        return false;
+
+    slab_batch_t cursor;
+    if (!slab_alloc_batch(&qu->slab, &cursor, bytes, n)) {
+        if (intern_mode)
+            intern_put_many(s, n);
+        return false;
+    }
+
+    char *shared = NULL;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(s[i]);
+        if (intern_mode && (!i || s[i] != s[i - 1]))
+            shared = intern_find(s[i], len);
+        element_t *el = slab_batch_next(&cursor, q_element_size(len));
+        q_init_element(el, s[i], len, shared);
+        if (tail)
+            q_push_tail(qu, el);
+        else
+            q_push_head(qu, el);
+    }
+    return true;
+}
+
+/* Insert a batch of elements at head of queue */
+bool q_insert_head_many(struct list_head *head, char **s, size_t n)
+{
+    if (!head)
+        return false;
+    return !n || q_insert_many(q_hdr(head), s, n, false);
+}
+
+/* Insert a batch of elements at tail of queue */
+bool q_insert_tail_many(struct list_head *head, char **s, size_t n)
+{
+    if (!head)
+        return false;
+    return !n || q_insert_many(q_hdr(head), s, n, true);
+}
+
+/* Copy the string of @el, only as many bytes as it holds rather than padding
+ * the whole buffer as strncpy() would
+ */
+static inline void q_copy_string(char *dst,
+                                 const element_t *el,
+                                 size_t bufsize)
+{
+    if (dst && bufsize) {
+        size_t len = el->len < bufsize - 1 ? el->len : bufsize - 1;
+        memcpy(dst, el->value, len);
+        dst[len] = '\0';
+    }
+}
+
+/* Remove an element from head of queue without copying its string */
+element_t *q_pop_head(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return NULL;
+
+    queue_t *qu = q_hdr(head);
+    q_chunk_t *c = chunk_of(head->next);
+    element_t *el = c->slot[c->first++];
+    if (!--c->count)
+        chunk_drop(qu, c);
+    qu->size--;
+    return el;
+}
+
+/* Remove an element from tail of queue without copying its string */
+element_t *q_pop_tail(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return NULL;
+
+    queue_t *qu = q_hdr(head);
+    q_chunk_t *c = chunk_of(head->prev);
+    element_t *el = c->slot[c->first + --c->count];
+    if (!c->count)
+        chunk_drop(qu, c);
+    qu->size--;
+    return el;
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *el = q_pop_head(head);
+    if (el)
+        q_copy_string(sp, el, bufsize);
+    return el;
+}
+
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *el = q_pop_tail(head);
+    if (el)
+        q_copy_string(sp, el, bufsize);
+    return el;
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+    return q_hdr(head)->size;
+}
+
+/* Delete the middle node in queue, the same one as the list backend does */
+bool q_delete_mid(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return false;
+
+    queue_t *qu = q_hdr(head);
+    int mid = (qu->size - 1) / 2;
+    q_chunk_t *c;
+    list_for_each_entry (c, head, list) {
+        if (mid < c->count)
+            break;
+        mid -= c->count;
+    }
+
+    /* close the gap from whichever side of the chunk is shorter */
+    element_t **slot = &c->slot[c->first];
+    q_release_element(slot[mid]);
+    if (mid < c->count / 2) {
+        memmove(slot + 1, slot, mid * sizeof(*slot));
+        c->first++;
+    } else {
+        memmove(slot + mid, slot + mid + 1,
+                (c->count - mid - 1) * sizeof(*slot));
+    }
+    if (!--c->count)
+        chunk_drop(qu, c);
+    qu->size--;
+    return true;
+}
+
+/* Pack the elements left after slots were cleared to NULL towards the head,
+ * refilling the chunks from their first slot and retiring those left empty
+ */
+static void q_compact(queue_t *qu)
+{
+    /* the chunk written to never gets ahead of the one read from */
+    q_chunk_t *r, *safe, *w = NULL;
+    int wn = 0;
+    list_for_each_entry (r, &qu->head, list) {
+        for (int i = r->first; i < r->first + r->count; i++) {
+            element_t *el = r->slot[i];
+            if (!el)
+                continue;
+            if (!w) {
+                w = chunk_of(qu->head.next);
+            } else if (wn == Q_CHUNK_SLOTS) {
+                w = chunk_of(w->list.next);
+                wn = 0;
+            }
+            w->slot[wn++] = el;
+        }
+    }
+
+    bool past = !w;
+    list_for_each_entry_safe (r, safe, &qu->head, list) {
+        if (past) {
+            chunk_drop(qu, r);
+            continue;
+        }
+        r->first = 0;
+        r->count = r == w ? wn : Q_CHUNK_SLOTS;
+        past = r == w;
+    }
+}
+
+/* Number of buckets of the scratch table used by q_delete_dup() */
+#define DEDUP_HASH_BITS 16
+
+/* The buckets chain the first element seen with each string through the next
+ * links of the list member, which is not used otherwise by this backend, and
+ * the prev link marks the elements whose string occurs more than once.  The
+ * table is left empty after every call and reused.
+ */
+static element_t *dedup_table[1 << DEDUP_HASH_BITS];
+
+#define dedup_link(el) ((element_t *) (el)->list.next)
+#define dedup_marked(el) ((el)->list.prev != NULL)
+#define dedup_mark(el) ((el)->list.prev = &(el)->list)
+
+/* FNV-1a hash of the string of an element, folded to the size of the table */
+static inline uint32_t dedup_hash(const element_t *el)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < el->len; i++) {
+        h ^= (unsigned char) el->value[i];
+        h *= 16777619u;
+    }
+    return (h ^ (h >> DEDUP_HASH_BITS)) & ((1 << DEDUP_HASH_BITS) - 1);
+}
+
+/* Delete all nodes that have duplicate string */
+bool q_delete_dup(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return false;
+
+    queue_t *qu = q_hdr(head);
+    q_chunk_t *c;
+
+    /* first pass: find out which strings occur more than once */
+    list_for_each_entry (c, head, list) {
+        for (int i = c->first; i < c->first + c->count; i++) {
+            element_t *el = c->slot[i];
+            element_t **bucket = &dedup_table[dedup_hash(el)];
+            element_t *first = *bucket;
+            while (first && q_compare(first, el))
+                first = dedup_link(first);
+            if (first) {
+                dedup_mark(first);
+                dedup_mark(el);
+            } else {
+                el->list.next = (struct list_head *) *bucket;
+                el->list.prev = NULL;
+                *bucket = el;
+            }
+        }
+    }
+
+    /* second pass: drop the marked elements and empty the table */
+    list_for_each_entry (c, head, list) {
+        for (int i = c->first; i < c->first + c->count; i++) {
+            element_t *el = c->slot[i];
+            dedup_table[dedup_hash(el)] = NULL;
+            if (dedup_marked(el)) {
+                q_release_element(el);
+                c->slot[i] = NULL;
+                qu->size--;
+            }
+        }
+    }
+    q_compact(qu);
+    return true;
+}
+
+static inline element_t **q_iter_slot(q_iter_t *it)
+{
+    return &chunk_of(it->pos)->slot[it->idx];
+}
+
+/* Reverse the nodes of the list k at a time */
+void q_reverseK(struct list_head *head, int k)
+{
+    if (!head || list_empty(head) || k <= 1)
+        return;
+
+    /* swap the elements of each group of k from both ends inwards, the
+     * group left over at the end keeps its order
+     */
+    q_iter_t start;
+    q_iter_first(&start, head);
+    for (int left = q_hdr(head)->size; left >= k; left -= k) {
+        q_iter_t l = start, r = start;
+        for (int i = 1; i < k; i++)
+            q_iter_next(&r);
+        start = r;
+        q_iter_next(&start);
+
+        for (int i = 0; i < k / 2; i++) {
+            element_t **a = q_iter_slot(&l), **b = q_iter_slot(&r);
+            element_t *tmp = *a;
+            *a = *b;
+            *b = tmp;
+            q_iter_next(&l);
+            q_iter_prev(&r);
+        }
+    }
+}
+
+/* Swap every two adjacent nodes */
+void q_swap(struct list_head *head)
+{
+    q_reverseK(head, 2);
+}
+
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return;
+
+    struct list_head *li, *safe, *tmp;
+    list_for_each_safe (li, safe, head) {
+        q_chunk_t *c = chunk_of(li);
+        element_t **l = &c->slot[c->first], **r = l + c->count - 1;
+        for (; l < r; l++, r--) {
+            element_t *el = *l;
+            *l = *r;
+            *r = el;
+        }
+        tmp = li->next;
+        li->next = li->prev;
+        li->prev = tmp;
+    }
+    tmp = head->next;
+    head->next = head->prev;
+    head->prev = tmp;
+}
+
+/* Link the elements up through their list member and park every chunk among
+ * the spares, keeping the size for q_attach()
+ */
+void q_detach(struct list_head *head, struct list_head *list)
+{
+    queue_t *qu = q_hdr(head);
+    q_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, head, list) {
+        for (int i = c->first; i < c->first + c->count; i++)
+            list_add_tail(&c->slot[i]->list, list);
+        chunk_stash(qu, c);
+    }
+}
+
+/* Refill the parked chunks from their first slot with the elements of @list,
+ * which are as many as q_detach() lent out, so no chunk has to be allocated
+ */
+void q_attach(struct list_head *head, struct list_head *list)
+{
+    queue_t *qu = q_hdr(head);
+    q_chunk_t *c = NULL;
+    element_t *el, *safe;
+    list_for_each_entry_safe (el, safe, list, list) {
+        if (!c || c->count == Q_CHUNK_SLOTS) {
+            c = chunk_get(qu);
+            c->first = 0;
+            list_add_tail(&c->list, head);
+        }
+        c->slot[c->count++] = el;
+    }
+    INIT_LIST_HEAD(list);
+}
+
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
+{
+    if (q_size(head) < 2)
+        return;
+
+    /* sorting moves elements across chunks, do it on a list of them */
+    LIST_HEAD(list);
+    q_detach(head, &list);
+    linux_list_sort(&list, descend);
+    q_attach(head, &list);
+}
+
+static int q_strict(struct list_head *head, int descend)
+{
+    if (!head || q_size(head) < 2)
+        return q_size(head);
+
+    queue_t *qu = q_hdr(head);
+    const element_t *last = NULL;
+    q_iter_t it;
+    for (element_t *el = q_iter_last(&it, head); el; el = q_iter_prev(&it)) {
+        if (last && q_compare(el, last) * descend > 0) {
+            q_release_element(el);
+            *q_iter_slot(&it) = NULL;
+            qu->size--;
+        } else {
+            last = el;
+        }
+    }
+    q_compact(qu);
+    return qu->size;
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+int q_ascend(struct list_head *head)
+{
+    return q_strict(head, 1);
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+int q_descend(struct list_head *head)
+{
+    return q_strict(head, -1);
+}
+
+/* Most queues merged in one round of q_merge() */
+#define MERGE_FANIN 1024
+
+/**
+ * merge_src_t - Run of sorted elements taking part in a k-way merge
+ * @list: the elements, the first one being the next it contributes
+ * @order: position of the run in the chain, breaking ties between equal
+ *         elements so that the merge is stable
+ */
+typedef struct {
+    struct list_head *list;
+    int order;
+} merge_src_t;
+
+/* Whether the next element of @a goes out before the one of @b */
+static inline bool merge_before(const merge_src_t *a,
+                                const merge_src_t *b,
+                                bool descend)
+{
+    int c = q_compare(list_first_entry(a->list, element_t, list),
+                      list_first_entry(b->list, element_t, list));
+    if (!c)
+        return a->order < b->order;
+    return descend ? c > 0 : c < 0;
+}
+
+static void merge_sift_down(merge_src_t *heap, int n, int i, bool descend)
+{
+    merge_src_t src = heap[i];
+    for (int child; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n &&
+            merge_before(&heap[child + 1], &heap[child], descend))
+            child++;
+        if (!merge_before(&heap[child], &src, descend))
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = src;
+}
+
+/* Merge the @n non-empty runs of @heap into @out through a binary heap keyed
+ * on their first elements, moving every element exactly once.
+ */
+static void merge_heap(struct list_head *out,
+                       merge_src_t *heap,
+                       int n,
+                       bool descend)
+{
+    for (int i = n / 2 - 1; i >= 0; i--)
+        merge_sift_down(heap, n, i, descend);
+
+    while (n) {
+        struct list_head *list = heap[0].list;
+        list_move_tail(list->next, out);
+        if (list_empty(list))
+            heap[0] = heap[--n];
+        merge_sift_down(heap, n, 0, descend);
+    }
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+int q_merge(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *ctx = list_first_entry(head, queue_contex_t, chain);
+    if (!ctx->q)
+        return 0;
+    queue_t *first = q_hdr(ctx->q);
+
+    /* Merge the queues as lists of their elements, up to MERGE_FANIN at a
+     * time.  The first queue takes over the arenas and the chunks of the
+     * others, which leaves it enough chunks to store the result.
+     */
+    struct list_head runs[MERGE_FANIN];
+    merge_src_t heap[MERGE_FANIN];
+    LIST_HEAD(merged);
+    q_detach(ctx->q, &merged);
+
+    struct list_head *li = head->next->next;
+    while (li != head) {
+        int n = 0;
+        INIT_LIST_HEAD(&runs[0]);
+        list_splice_init(&merged, &runs[0]);
+        if (!list_empty(&runs[0])) {
+            heap[n].list = &runs[0];
+            heap[n].order = n;
+            n++;
+        }
+        for (; li != head && n < MERGE_FANIN; li = li->next) {
+            ctx = list_entry(li, queue_contex_t, chain);
+            if (!ctx->q)
+                continue;
+            queue_t *qu = q_hdr(ctx->q);
+            INIT_LIST_HEAD(&runs[n]);
+            q_detach(ctx->q, &runs[n]);
+            if (!list_empty(&runs[n])) {
+                heap[n].list = &runs[n];
+                heap[n].order = n;
+                n++;
+            }
+            first->size += qu->size;
+            qu->size = 0;
+            list_splice_init(&qu->spares, &first->spares);
+            first->nspares += qu->nspares;
+            qu->nspares = 0;
+            slab_merge(&first->slab, &qu->slab);
+        }
+        merge_heap(&merged, heap, n, descend);
+    }
+
+    q_attach(&first->head, &merged);
+    return first->size;
+}
+
+/* q_merge() takes over the chunks of the queues it merges, which are enough to
+ * hold the result, so there is nothing to set aside
+ */
+bool q_reserve(struct list_head *head, int n)
+{
+    return head != NULL;
+}
+
+/* Point @it at the first or last element of the chunk linked at @pos, or past
+ * the end if @pos is the head
+ */
+static inline element_t *q_iter_enter(q_iter_t *it,
+                                      struct list_head *pos,
+                                      bool front)
+{
+    it->pos = pos;
+    if (pos == it->head)
+        return NULL;
+    q_chunk_t *c = chunk_of(pos);
+    it->idx = front ? c->first : c->first + c->count - 1;
+    return c->slot[it->idx];
+}
+
+element_t *q_iter_first(q_iter_t *it, struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    it->head = head;
+    return q_iter_enter(it, head->next, true);
+}
+
+element_t *q_iter_last(q_iter_t *it, struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    it->head = head;
+    return q_iter_enter(it, head->prev, false);
+}
+
+element_t *q_iter_next(q_iter_t *it)
+{
+    q_chunk_t *c = chunk_of(it->pos);
+    if (++it->idx < c->first + c->count)
+        return c->slot[it->idx];
+    return q_iter_enter(it, it->pos->next, true);
+}
+
+element_t *q_iter_prev(q_iter_t *it)
+{
+    q_chunk_t *c = chunk_of(it->pos);
+    if (--it->idx >= c->first)
+        return c->slot[it->idx];
+    return q_iter_enter(it, it->pos->prev, false);
+}
+
+bool q_check(struct list_head *head)
+{
+    if (!head)
+        return true;
+
+    /* the chunk list must be doubly linked and come back to the head, with
+     * every chunk holding between 1 and Q_CHUNK_SLOTS elements which add up
+     * to the size
+     */
+    int size = q_hdr(head)->size, n = 0;
+    for (struct list_head *li = head;; li = li->next) {
+        if (!li->next || li->next->prev != li)
+            return false;
+        if (li->next == head)
+            break;
+        const q_chunk_t *c = chunk_of(li->next);
+        if (c->count < 1 || c->first < 0 ||
+            c->first + c->count > Q_CHUNK_SLOTS)
+            return false;
+        for (int i = c->first; i < c->first + c->count; i++) {
+            if (!c->slot[i])
+                return false;
+        }
+        n += c->count;
+        if (n > size)
+            return false;
+    }
+    return n == size;
+}
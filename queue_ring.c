@@ -0,0 +1,775 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "intern.h"
+#include "list.h"
+#include "queue.h"
+
+/* Queue backend storing the element pointers in a ring buffer, built with
+ * QUEUE=ring.  Both ends are reached in constant time, the element at any
+ * position is found without walking the queue, and sorting and merging run
+ * on contiguous arrays of pointers.
+ */
+
+/* Capacity of the ring once the first element is inserted */
+#define Q_RING_MIN 16
+
+/**
+ * queue_t - Header of a queue stored as a ring buffer
+ * @head: the list head handed out by q_new(), which links nothing
+ * @mem: storage of two arrays of @cap element pointers
+ * @ring: the array holding the elements, either half of @mem
+ * @spare: the other half of @mem, scratch space for sorting and merging
+ * @cap: number of pointers in each half, zero or a power of two
+ * @first: slot of @ring holding the first element
+ * @size: number of elements in the queue
+ * @slab: arena the elements of this queue are carved out of
+ *
+ * The elements are in slots @first to @first + @size - 1 of @ring, wrapping
+ * around at @cap.  @mem is obtained with realloc() and doubled whenever the
+ * ring fills up, so inserting takes amortized constant time.  It only shrinks
+ * when the queue is freed.
+ */
+typedef struct {
+    struct list_head head;
+    element_t **mem, **ring, **spare;
+    int cap, first, size;
+    slab_t slab;
+} queue_t;
+
+#define q_hdr(h) container_of(h, queue_t, head)
+
+/* Slot of the element at position i of the queue */
+#define ring_at(qu, i) ((qu)->ring[((qu)->first + (i)) & ((qu)->cap - 1)])
+
+/* Swap the roles of the two halves of the storage */
+static inline void ring_flip(queue_t *qu)
+{
+    element_t **tmp = qu->ring;
+    qu->ring = qu->spare;
+    qu->spare = tmp;
+}
+
+/* Move the elements to the start of the spare half, if they do not begin at
+ * the first slot already, and make it the ring
+ */
+static void ring_straighten(queue_t *qu)
+{
+    if (!qu->first)
+        return;
+    for (int i = 0; i < qu->size; i++)
+        qu->spare[i] = ring_at(qu, i);
+    ring_flip(qu);
+    qu->first = 0;
+}
+
+/* Make room for at least n elements, false for allocation failed */
+static bool ring_grow(queue_t *qu, int n)
+{
+    if (n <= qu->cap)
+        return true;
+
+    int cap = qu->cap ? qu->cap : Q_RING_MIN;
+    while (cap < n)
+        cap *= 2;
+
+    /* the elements start at slot 0 of either half, which realloc() keeps */
+    ring_straighten(qu);
+    size_t off = qu->ring - qu->mem;
+    element_t **mem = realloc(qu->mem, 2 * cap * sizeof(element_t *));
+    if (!mem)
+        return false;
+    memmove(mem, mem + off, qu->size * sizeof(element_t *));
+    qu->mem = qu->ring = mem;
+    qu->spare = mem + cap;
+    qu->cap = cap;
+    return true;
+}
+
+/* Create an empty queue */
+struct list_head *q_new()
+{
+    queue_t *qu = malloc(sizeof(queue_t));
+    if (!qu)
+        return NULL;
+    INIT_LIST_HEAD(&qu->head);
+    qu->mem = qu->ring = qu->spare = NULL;
+    qu->cap = qu->first = qu->size = 0;
+    slab_init(&qu->slab);
+    return &qu->head;
+}
+
+/* Free all storage used by queue */
+void q_free(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    queue_t *qu = q_hdr(head);
+    if (qu->slab.live == qu->size && !intern_refs()) {
+        /* no element has left the queue nor holds an interned string, drop
+         * the whole arena at once
+         */
+        slab_purge(&qu->slab);
+    } else {
+        for (int i = 0; i < qu->size; i++)
+            q_release_element(ring_at(qu, i));
+    }
+    slab_destroy(&qu->slab);
+    free(qu->mem);
+    free(qu);
+}
+
+/* Initialize an element holding @s, whose length is @len, either in a copy of
+ * its own or in @shared, the copy held by the intern table, if not NULL
+ */
+static inline element_t *q_init_element(element_t *el,
+                                        char *s,
+                                        size_t len,
+                                        char *shared)
+{
+    el->value = shared ? shared : memcpy(el->data, s, len + 1);
+    el->key = q_key(s, len);
+    el->len = len;
+    return el;
+}
+
+/* Bytes taken by an element holding a string of length @len */
+static inline size_t q_element_size(size_t len)
+{
+    return sizeof(element_t) + (intern_mode ? 0 : len + 1);
+}
+
+static inline element_t *q_new_element(queue_t *qu, char *s)
+{
+    size_t len = strlen(s);
+    element_t *el = slab_alloc(&qu->slab, q_element_size(len));
+    if (!el)
+        return NULL;
+
+    char *shared = NULL;
+    if (intern_mode && !(shared = intern_get(s, len))) {
+        slab_free(el);
+        return NULL;
+    }
+    return q_init_element(el, s, len, shared);
+}
+
+/* Store @el in front of the first element, the ring must have room for it */
+static inline void q_push_head(queue_t *qu, element_t *el)
+{
+    qu->first = (qu->first - 1) & (qu->cap - 1);
+    qu->ring[qu->first] = el;
+    qu->size++;
+}
+
+/* Store @el after the last element, the ring must have room for it */
+static inline void q_push_tail(queue_t *qu, element_t *el)
+{
+    ring_at(qu, qu->size) = el;
+    qu->size++;
+}
+
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    if (!head || !s)
+        return false;
+
+    queue_t *qu = q_hdr(head);
+    element_t *el;
+    if (!ring_grow(qu, qu->size + 1) || !(el = q_new_element(qu, s)))
+        return false;
+    q_push_head(qu, el);
+    return true;
+}
+
+/* Insert an element at tail of queue */
+bool q_insert_tail(struct list_head *head, char *s)
+{
+    if (!head || !s)
+        return false;
+
+    queue_t *qu = q_hdr(head);
+    element_t *el;
+    if (!ring_grow(qu, qu->size + 1) || !(el = q_new_element(qu, s)))
+        return false;
+    q_push_tail(qu, el);
+    return true;
+}
+
+/* Allocate the elements of a batch from a single chunk of the arena and push
+ * them in the order of @s at the tail, or at the head if @tail is not set
+ */
+static bool q_insert_many(queue_t *qu, char **s, size_t n, bool tail)
+{
+    if (!s || n > INT_MAX - (size_t) qu->size)
+        return false;
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!s[i])
+            return false;
+        bytes += slab_size(q_element_size(strlen(s[i])));
+    }
+
+    if (!ring_grow(qu, qu->size + n))
+        return false;
+
+    if (intern_mode && !intern_get_many(s, n))
+        return false;
+
+    slab_batch_t cursor;
+    if (!slab_alloc_batch(&qu->slab, &cursor, bytes, n)) {
+        if (intern_mode)
+            intern_put_many(s, n);
+        return false;
+    }
+
+    char *shared = NULL;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(s[i]);
+        if (intern_mode && (!i || s[i] != s[i - 1]))
+            shared = intern_find(s[i], len);
+        element_t *el = slab_batch_next(&cursor, q_element_size(len));
+        q_init_element(el, s[i], len, shared);
+        if (tail)
+            q_push_tail(qu, el);
+        else
+            q_push_head(qu, el);
+    }
+    return true;
+}
+
+/* Insert a batch of elements at head of queue */
+bool q_insert_head_many(struct list_head *head, char **s, size_t n)
+{
+    if (!head)
+        return false;
+    return !n || q_insert_many(q_hdr(head), s, n, false);
+}
+
+/* Insert a batch of elements at tail of queue */
+bool q_insert_tail_many(struct list_head *head, char **s, size_t n)
+{
+    if (!head)
+        return false;
+    return !n || q_insert_many(q_hdr(head), s, n, true);
+}
+
+/* Copy the string of @el, only as many bytes as it holds rather than padding
+ * the whole buffer as strncpy() would
+ */
+static inline void q_copy_string(char *dst,
+                                 const element_t *el,
+                                 size_t bufsize)
+{
+    if (dst && bufsize) {
+        size_t len = el->len < bufsize - 1 ? el->len : bufsize - 1;
+        memcpy(dst, el->value, len);
+        dst[len] = '\0';
+    }
+}
+
+/* Remove an element from head of queue without copying its string */
+element_t *q_pop_head(struct list_head *head)
+{
+    if (!head || !q_hdr(head)->size)
+        return NULL;
+
+    queue_t *qu = q_hdr(head);
+    element_t *el = qu->ring[qu->first];
+    qu->first = (qu->first + 1) & (qu->cap - 1);
+    qu->size--;
+    return el;
+}
+
+/* Remove an element from tail of queue without copying its string */
+element_t *q_pop_tail(struct list_head *head)
+{
+    if (!head || !q_hdr(head)->size)
+        return NULL;
+
+    queue_t *qu = q_hdr(head);
+    return ring_at(qu, --qu->size);
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *el = q_pop_head(head);
+    if (el)
+        q_copy_string(sp, el, bufsize);
+    return el;
+}
+
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *el = q_pop_tail(head);
+    if (el)
+        q_copy_string(sp, el, bufsize);
+    return el;
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+    return q_hdr(head)->size;
+}
+
+/* Delete the middle node in queue, the same one as the list backend does */
+bool q_delete_mid(struct list_head *head)
+{
+    if (!head || !q_hdr(head)->size)
+        return false;
+
+    /* the middle element is found right away, and the gap it leaves is
+     * closed from the front, which is never the longer side
+     */
+    queue_t *qu = q_hdr(head);
+    int mid = (qu->size - 1) / 2;
+    q_release_element(ring_at(qu, mid));
+    for (int i = mid; i > 0; i--)
+        ring_at(qu, i) = ring_at(qu, i - 1);
+    qu->first = (qu->first + 1) & (qu->cap - 1);
+    qu->size--;
+    return true;
+}
+
+/* Pack the elements left after slots were cleared to NULL towards the head */
+static void q_compact(queue_t *qu)
+{
+    int n = 0;
+    for (int i = 0; i < qu->size; i++) {
+        element_t *el = ring_at(qu, i);
+        if (el)
+            ring_at(qu, n++) = el;
+    }
+    qu->size = n;
+}
+
+/* Number of buckets of the scratch table used by q_delete_dup() */
+#define DEDUP_HASH_BITS 16
+
+/* The buckets chain the first element seen with each string through the next
+ * links of the list member, which is not used otherwise by this backend, and
+ * the prev link marks the elements whose string occurs more than once.  The
+ * table is left empty after every call and reused.
+ */
+static element_t *dedup_table[1 << DEDUP_HASH_BITS];
+
+#define dedup_link(el) ((element_t *) (el)->list.next)
+#define dedup_marked(el) ((el)->list.prev != NULL)
+#define dedup_mark(el) ((el)->list.prev = &(el)->list)
+
+/* FNV-1a hash of the string of an element, folded to the size of the table */
+static inline uint32_t dedup_hash(const element_t *el)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < el->len; i++) {
+        h ^= (unsigned char) el->value[i];
+        h *= 16777619u;
+    }
+    return (h ^ (h >> DEDUP_HASH_BITS)) & ((1 << DEDUP_HASH_BITS) - 1);
+}
+
+/* Delete all nodes that have duplicate string */
+bool q_delete_dup(struct list_head *head)
+{
+    if (!head || !q_hdr(head)->size)
+        return false;
+
+    queue_t *qu = q_hdr(head);
+
+    /* first pass: find out which strings occur more than once */
+    for (int i = 0; i < qu->size; i++) {
+        element_t *el = ring_at(qu, i);
+        element_t **bucket = &dedup_table[dedup_hash(el)];
+        element_t *first = *bucket;
+        while (first && q_compare(first, el))
+            first = dedup_link(first);
+        if (first) {
+            dedup_mark(first);
+            dedup_mark(el);
+        } else {
+            el->list.next = (struct list_head *) *bucket;
+            el->list.prev = NULL;
+            *bucket = el;
+        }
+    }
+
+    /* second pass: drop the marked elements and empty the table */
+    for (int i = 0; i < qu->size; i++) {
+        element_t *el = ring_at(qu, i);
+        dedup_table[dedup_hash(el)] = NULL;
+        if (dedup_marked(el)) {
+            q_release_element(el);
+            ring_at(qu, i) = NULL;
+        }
+    }
+    q_compact(qu);
+    return true;
+}
+
+/* Swap the elements at positions i and j */
+static inline void ring_swap(queue_t *qu, int i, int j)
+{
+    element_t *tmp = ring_at(qu, i);
+    ring_at(qu, i) = ring_at(qu, j);
+    ring_at(qu, j) = tmp;
+}
+
+/* Reverse the nodes of the list k at a time */
+void q_reverseK(struct list_head *head, int k)
+{
+    if (!head || k <= 1)
+        return;
+
+    /* the group left over at the end keeps its order */
+    queue_t *qu = q_hdr(head);
+    for (int start = 0; qu->size - start >= k; start += k) {
+        for (int i = 0; i < k / 2; i++)
+            ring_swap(qu, start + i, start + k - 1 - i);
+    }
+}
+
+/* Swap every two adjacent nodes */
+void q_swap(struct list_head *head)
+{
+    q_reverseK(head, 2);
+}
+
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    queue_t *qu = q_hdr(head);
+    for (int i = 0; i < qu->size / 2; i++)
+        ring_swap(qu, i, qu->size - 1 - i);
+}
+
+/* Link the elements up through their list member, keeping the size for
+ * q_attach()
+ */
+void q_detach(struct list_head *head, struct list_head *list)
+{
+    queue_t *qu = q_hdr(head);
+    for (int i = 0; i < qu->size; i++)
+        list_add_tail(&ring_at(qu, i)->list, list);
+}
+
+/* Store the elements of @list, which are as many as q_detach() lent out, from
+ * the first slot of the ring on
+ */
+void q_attach(struct list_head *head, struct list_head *list)
+{
+    queue_t *qu = q_hdr(head);
+    element_t *el, *safe;
+    int i = 0;
+    list_for_each_entry_safe (el, safe, list, list)
+        qu->ring[i++] = el;
+    qu->first = 0;
+    INIT_LIST_HEAD(list);
+}
+
+/* Runs sorted by insertion before q_sort() starts merging them */
+#define SORT_RUN 16
+
+/* Whether @a goes strictly before @b */
+static inline bool sort_before(const element_t *a,
+                               const element_t *b,
+                               bool descend)
+{
+    int c = q_compare(a, b);
+    return descend ? c > 0 : c < 0;
+}
+
+static void sort_insertion(element_t **x, int n, bool descend)
+{
+    for (int i = 1; i < n; i++) {
+        element_t *el = x[i];
+        int j = i;
+        for (; j > 0 && sort_before(el, x[j - 1], descend); j--)
+            x[j] = x[j - 1];
+        x[j] = el;
+    }
+}
+
+/* Merge the sorted runs @a of @na and @b of @nb elements into @out, taking
+ * from @a first on ties so that the sort is stable
+ */
+static void sort_merge(element_t **out,
+                       element_t **a,
+                       int na,
+                       element_t **b,
+                       int nb,
+                       bool descend)
+{
+    element_t **ea = a + na, **eb = b + nb;
+    while (a < ea && b < eb)
+        *out++ = sort_before(*b, *a, descend) ? *b++ : *a++;
+    while (a < ea)
+        *out++ = *a++;
+    while (b < eb)
+        *out++ = *b++;
+}
+
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
+{
+    if (q_size(head) < 2)
+        return;
+
+    /* bottom-up merge sort going back and forth between the two halves of
+     * the storage, so no memory is allocated
+     */
+    queue_t *qu = q_hdr(head);
+    ring_straighten(qu);
+    int n = qu->size;
+    element_t **src = qu->ring, **dst = qu->spare;
+    for (int lo = 0; lo < n; lo += SORT_RUN)
+        sort_insertion(src + lo, n - lo < SORT_RUN ? n - lo : SORT_RUN,
+                       descend);
+
+    for (int width = SORT_RUN; width < n; width *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * width) {
+            int na = n - lo < width ? n - lo : width;
+            int nb = n - lo - na < width ? n - lo - na : width;
+            sort_merge(dst + lo, src + lo, na, src + lo + na, nb, descend);
+        }
+        element_t **tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != qu->ring)
+        ring_flip(qu);
+}
+
+static int q_strict(struct list_head *head, int descend)
+{
+    if (!head || q_size(head) < 2)
+        return q_size(head);
+
+    queue_t *qu = q_hdr(head);
+    const element_t *last = NULL;
+    for (int i = qu->size - 1; i >= 0; i--) {
+        element_t *el = ring_at(qu, i);
+        if (last && q_compare(el, last) * descend > 0) {
+            q_release_element(el);
+            ring_at(qu, i) = NULL;
+        } else {
+            last = el;
+        }
+    }
+    q_compact(qu);
+    return qu->size;
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+int q_ascend(struct list_head *head)
+{
+    return q_strict(head, 1);
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+int q_descend(struct list_head *head)
+{
+    return q_strict(head, -1);
+}
+
+/* Most queues merged in one round of q_merge() */
+#define MERGE_FANIN 1024
+
+/**
+ * merge_src_t - Run of sorted elements taking part in a k-way merge
+ * @next: the next element it contributes
+ * @end: past its last element
+ * @order: position of the run in the chain, breaking ties between equal
+ *         elements so that the merge is stable
+ */
+typedef struct {
+    element_t **next, **end;
+    int order;
+} merge_src_t;
+
+/* Whether the next element of @a goes out before the one of @b */
+static inline bool merge_before(const merge_src_t *a,
+                                const merge_src_t *b,
+                                bool descend)
+{
+    int c = q_compare(*a->next, *b->next);
+    if (!c)
+        return a->order < b->order;
+    return descend ? c > 0 : c < 0;
+}
+
+static void merge_sift_down(merge_src_t *heap, int n, int i, bool descend)
+{
+    merge_src_t src = heap[i];
+    for (int child; (child = 2 * i + 1) < n; i = child) {
+        if (child + 1 < n &&
+            merge_before(&heap[child + 1], &heap[child], descend))
+            child++;
+        if (!merge_before(&heap[child], &src, descend))
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = src;
+}
+
+/* Merge the @n non-empty runs of @heap into @out through a binary heap keyed
+ * on their next elements
+ */
+static void merge_heap(element_t **out, merge_src_t *heap, int n, bool descend)
+{
+    for (int i = n / 2 - 1; i >= 0; i--)
+        merge_sift_down(heap, n, i, descend);
+
+    while (n) {
+        *out++ = *heap[0].next++;
+        if (heap[0].next == heap[0].end)
+            heap[0] = heap[--n];
+        merge_sift_down(heap, n, 0, descend);
+    }
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+int q_merge(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *ctx = list_first_entry(head, queue_contex_t, chain);
+    if (!ctx->q)
+        return 0;
+    queue_t *first = q_hdr(ctx->q);
+
+    /* the room for the result is set aside by q_reserve() beforehand */
+    int total = 0;
+    list_for_each_entry (ctx, head, chain) {
+        if (ctx->q)
+            total += q_hdr(ctx->q)->size;
+    }
+    if (!ring_grow(first, total))
+        return first->size;
+
+    /* Merge up to MERGE_FANIN queues at a time from their rings into the
+     * spare half of the first one, which then becomes its ring.  The first
+     * queue takes over the arenas of the others.
+     */
+    merge_src_t heap[MERGE_FANIN];
+    struct list_head *li = head->next->next;
+    while (li != head) {
+        int n = 0;
+        ring_straighten(first);
+        if (first->size) {
+            heap[n].next = first->ring;
+            heap[n].end = first->ring + first->size;
+            heap[n].order = n;
+            n++;
+        }
+        for (; li != head && n < MERGE_FANIN; li = li->next) {
+            ctx = list_entry(li, queue_contex_t, chain);
+            if (!ctx->q)
+                continue;
+            queue_t *qu = q_hdr(ctx->q);
+            if (qu->size) {
+                ring_straighten(qu);
+                heap[n].next = qu->ring;
+                heap[n].end = qu->ring + qu->size;
+                heap[n].order = n;
+                n++;
+            }
+            first->size += qu->size;
+            qu->size = 0;
+            slab_merge(&first->slab, &qu->slab);
+        }
+        merge_heap(first->spare, heap, n, descend);
+        ring_flip(first);
+    }
+    return first->size;
+}
+
+/* Grow the ring to hold n elements, so q_merge() does not have to */
+bool q_reserve(struct list_head *head, int n)
+{
+    if (!head)
+        return false;
+    return ring_grow(q_hdr(head), n);
+}
+
+/* Element under the cursor, NULL if it went past either end */
+static inline element_t *q_iter_at(q_iter_t *it)
+{
+    queue_t *qu = q_hdr(it->head);
+    if (it->idx < 0 || it->idx >= qu->size)
+        return NULL;
+    return ring_at(qu, it->idx);
+}
+
+element_t *q_iter_first(q_iter_t *it, struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    it->head = it->pos = head;
+    it->idx = 0;
+    return q_iter_at(it);
+}
+
+element_t *q_iter_last(q_iter_t *it, struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    it->head = it->pos = head;
+    it->idx = q_hdr(head)->size - 1;
+    return q_iter_at(it);
+}
+
+element_t *q_iter_next(q_iter_t *it)
+{
+    it->idx++;
+    return q_iter_at(it);
+}
+
+element_t *q_iter_prev(q_iter_t *it)
+{
+    it->idx--;
+    return q_iter_at(it);
+}
+
+bool q_check(struct list_head *head)
+{
+    if (!head)
+        return true;
+
+    /* the head links nothing, the ring and the spare array are the two
+     * halves of the storage, and every slot in use points at an element
+     */
+    const queue_t *qu = q_hdr(head);
+    if (head->next != head || head->prev != head)
+        return false;
+    if (qu->cap < 0 || (qu->cap & (qu->cap - 1)) || qu->size < 0 ||
+        qu->size > qu->cap || qu->first < 0 ||
+        (qu->cap && qu->first >= qu->cap))
+        return false;
+    if (qu->cap && !(qu->ring == qu->mem && qu->spare == qu->mem + qu->cap) &&
+        !(qu->spare == qu->mem && qu->ring == qu->mem + qu->cap))
+        return false;
+    for (int i = 0; i < qu->size; i++) {
+        if (!ring_at(qu, i))
+            return false;
+    }
+    return true;
+}
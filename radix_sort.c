@@ -0,0 +1,111 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "harness.h"
+#include "list.h"
+#include "list_sort.h"
+#include "queue.h"
+#include "radix_sort.h"
+
+/* Lists shorter than this are finished off by insertion sort */
+#define RADIX_CUTOFF 32
+
+/* Deepest byte position distributed on, longer common prefixes are finished
+ * off by a comparison sort to bound the recursion
+ */
+#define RADIX_MAX_DEPTH 16
+
+#define RADIX_BUCKETS 256
+
+static inline unsigned char key_byte(struct list_head *li, size_t depth)
+{
+    const element_t *el = list_entry(li, element_t, list);
+    /* the leading bytes are cached in the key, no need to touch the string */
+    if (depth < sizeof(el->key))
+        return el->key >> (8 * (sizeof(el->key) - 1 - depth));
+    return el->value[depth];
+}
+
+/* Stable insertion sort */
+static void insertion_sort(struct list_head *head, bool descend)
+{
+    struct list_head *li = head->next->next, *safe;
+    for (; li != head; li = safe) {
+        const element_t *el = list_entry(li, element_t, list);
+        struct list_head *pos = li->prev;
+        safe = li->next;
+        while (pos != head) {
+            int c = q_compare(list_entry(pos, element_t, list), el);
+            if (descend ? c >= 0 : c <= 0)
+                break;
+            pos = pos->prev;
+        }
+        if (pos != li->prev) {
+            list_del(li);
+            list_add(li, pos);
+        }
+    }
+}
+
+/**
+ * radix_pass() - Sort strings sharing their first @depth bytes
+ * @head: list of @n elements to be sorted
+ * @n: number of elements in @head
+ * @depth: position of the byte to distribute the elements on
+ * @descend: whether or not to sort in descending order
+ *
+ * Elements are appended to the bucket of their byte at @depth, which keeps
+ * the sort stable. The bucket of the terminating null byte holds equal
+ * strings only and needs no further pass.
+ */
+static void radix_pass(struct list_head *head,
+                       size_t n,
+                       size_t depth,
+                       bool descend)
+{
+    if (n < 2)
+        return;
+    if (n < RADIX_CUTOFF) {
+        insertion_sort(head, descend);
+        return;
+    }
+    if (depth >= RADIX_MAX_DEPTH) {
+        linux_list_sort(head, descend);
+        return;
+    }
+
+    struct list_head bucket[RADIX_BUCKETS];
+    size_t count[RADIX_BUCKETS] = {0};
+    for (int c = 0; c < RADIX_BUCKETS; c++)
+        INIT_LIST_HEAD(&bucket[c]);
+
+    struct list_head *li, *safe;
+    list_for_each_safe (li, safe, head) {
+        unsigned char c = key_byte(li, depth);
+        list_add_tail(li, &bucket[c]);
+        count[c]++;
+    }
+    INIT_LIST_HEAD(head);
+
+    for (int i = 0; i < RADIX_BUCKETS; i++) {
+        int c = descend ? RADIX_BUCKETS - 1 - i : i;
+        if (!count[c])
+            continue;
+        if (c)
+            radix_pass(&bucket[c], count[c], depth + 1, descend);
+        list_splice_tail(&bucket[c], head);
+    }
+}
+
+/* Most-significant-digit radix sort of a queue */
+void radix_sort(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
+
+    size_t n = 0;
+    struct list_head *li;
+    list_for_each (li, head)
+        n++;
+    radix_pass(head, n, 0, descend);
+}
@@ -0,0 +1,6 @@
+#ifndef LAB0_RADIX_SORT_H
+#define LAB0_RADIX_SORT_H
+
+void radix_sort(struct list_head *head, bool descend);
+
+#endif /* LAB0_RADIX_SORT_H */
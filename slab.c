@@ -0,0 +1,186 @@
+#include <stddef.h>
+
+#include "harness.h"
+#include "slab.h"
+
+/* Size of a regular chunk, including its header */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+/* Objects larger than this get a chunk on their own */
+#define SLAB_LARGE_OBJECT (SLAB_CHUNK_SIZE / 4)
+
+#define SLAB_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/**
+ * slab_chunk_t - Block of memory objects are carved out of
+ * @list: node in the chunk list of the owning arena
+ * @owner: arena owning this chunk, NULL once the arena is destroyed
+ * @live: number of objects in this chunk not yet released
+ * @used: number of bytes of @mem handed out
+ * @size: capacity of @mem in bytes
+ * @mem: storage of the objects
+ *
+ * Every object is preceded by a pointer to its chunk, which is how
+ * slab_free() finds its way back.
+ */
+typedef struct __slab_chunk {
+    struct list_head list;
+    slab_t *owner;
+    size_t live;
+    size_t used, size;
+    unsigned char mem[];
+} slab_chunk_t;
+
+static inline slab_chunk_t **obj_chunk(void *obj)
+{
+    return (slab_chunk_t **) obj - 1;
+}
+
+/* Allocate a chunk, charged in memory profiling mode to @site, the caller of
+ * the slab function which needed it, since every chunk comes from here
+ */
+static slab_chunk_t *chunk_new(slab_t *slab, size_t size, const void *site)
+{
+    slab_chunk_t *c = test_malloc_at(sizeof(slab_chunk_t) + size, site);
+    if (!c)
+        return NULL;
+    c->owner = slab;
+    c->live = 0;
+    c->used = 0;
+    c->size = size;
+    return c;
+}
+
+void slab_init(slab_t *slab)
+{
+    INIT_LIST_HEAD(&slab->chunks);
+    slab->live = 0;
+}
+
+size_t slab_size(size_t size)
+{
+    return SLAB_ALIGN(size + sizeof(slab_chunk_t *));
+}
+
+void *slab_alloc(slab_t *slab, size_t size)
+{
+    const void *site = __builtin_return_address(0);
+    size = slab_size(size);
+
+    slab_chunk_t *c = NULL;
+    if (size > SLAB_LARGE_OBJECT) {
+        /* keep the chunk being carved from at the front */
+        if (!(c = chunk_new(slab, size, site)))
+            return NULL;
+        list_add_tail(&c->list, &slab->chunks);
+    } else {
+        if (!list_empty(&slab->chunks))
+            c = list_first_entry(&slab->chunks, slab_chunk_t, list);
+        if (!c || c->size - c->used < size) {
+            c = chunk_new(slab, SLAB_CHUNK_SIZE - sizeof(slab_chunk_t), site);
+            if (!c)
+                return NULL;
+            list_add(&c->list, &slab->chunks);
+        }
+    }
+
+    /* the chunk is kept by the arena even if the harness refuses the object */
+    if (!test_suballoc(1))
+        return NULL;
+
+    slab_chunk_t **p = (slab_chunk_t **) (c->mem + c->used);
+    *p = c;
+    c->used += size;
+    c->live++;
+    slab->live++;
+    return p + 1;
+}
+
+bool slab_alloc_batch(slab_t *slab,
+                      slab_batch_t *batch,
+                      size_t bytes,
+                      size_t n)
+{
+    slab_chunk_t *c = chunk_new(slab, bytes, __builtin_return_address(0));
+    if (!c)
+        return false;
+    if (!test_suballoc(n)) {
+        test_free(c);
+        return false;
+    }
+
+    /* the chunk is full from the start, so it is never carved from again */
+    list_add_tail(&c->list, &slab->chunks);
+    c->used = bytes;
+    c->live = n;
+    slab->live += n;
+    batch->chunk = c;
+    batch->next = c->mem;
+    return true;
+}
+
+void *slab_batch_next(slab_batch_t *batch, size_t size)
+{
+    slab_chunk_t **p = (slab_chunk_t **) batch->next;
+    *p = batch->chunk;
+    batch->next += slab_size(size);
+    return p + 1;
+}
+
+void slab_free(void *obj)
+{
+    if (!obj)
+        return;
+
+    slab_chunk_t *c = *obj_chunk(obj);
+    slab_t *slab = c->owner;
+    test_subfree(1);
+    if (slab)
+        slab->live--;
+    if (--c->live)
+        return;
+
+    if (!slab) {
+        /* the last object of an orphaned chunk */
+        test_free(c);
+    } else if (c->list.prev == &slab->chunks) {
+        /* rewind the chunk being carved from instead of returning it */
+        c->used = 0;
+    } else {
+        list_del(&c->list);
+        test_free(c);
+    }
+}
+
+void slab_merge(slab_t *dst, slab_t *src)
+{
+    slab_chunk_t *c;
+    list_for_each_entry (c, &src->chunks, list)
+        c->owner = dst;
+    list_splice_tail_init(&src->chunks, &dst->chunks);
+    dst->live += src->live;
+    src->live = 0;
+}
+
+void slab_purge(slab_t *slab)
+{
+    slab_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &slab->chunks, list)
+        test_free(c);
+    INIT_LIST_HEAD(&slab->chunks);
+    test_subfree(slab->live);
+    slab->live = 0;
+}
+
+void slab_destroy(slab_t *slab)
+{
+    slab_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &slab->chunks, list) {
+        if (c->live)
+            c->owner = NULL;
+        else
+            test_free(c);
+    }
+    INIT_LIST_HEAD(&slab->chunks);
+    slab->live = 0;
+}
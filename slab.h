@@ -0,0 +1,72 @@
+#ifndef LAB0_SLAB_H
+#define LAB0_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/* A per-queue arena which carves queue elements out of large chunks.
+ *
+ * Chunks are obtained with test_malloc, while every object handed out is
+ * still registered with the harness through test_suballoc, so the leak
+ * accounting keeps counting live elements one by one.
+ */
+
+/**
+ * slab_t - Arena of objects carved out of large chunks
+ * @chunks: chunks owned by this arena, the one being carved from first
+ * @live: number of objects handed out and not yet released
+ */
+typedef struct {
+    struct list_head chunks;
+    size_t live;
+} slab_t;
+
+/**
+ * slab_batch_t - Cursor over a chunk reserved by slab_alloc_batch()
+ * @chunk: the chunk reserved for the batch
+ * @next: where the next object of the batch is carved out
+ */
+typedef struct {
+    void *chunk;
+    unsigned char *next;
+} slab_batch_t;
+
+/* Initialize an empty arena */
+void slab_init(slab_t *slab);
+
+/* Return @size bytes carved out of @slab, NULL for allocation failed */
+void *slab_alloc(slab_t *slab, size_t size);
+
+/* Number of bytes an object of @size bytes takes up inside a chunk */
+size_t slab_size(size_t size);
+
+/* Reserve a chunk of @bytes, as summed up with slab_size(), for @n objects to
+ * be carved out by slab_batch_next().  Return false for allocation failed.
+ */
+bool slab_alloc_batch(slab_t *slab,
+                      slab_batch_t *batch,
+                      size_t bytes,
+                      size_t n);
+
+/* Carve the next object of @size bytes out of a reserved chunk */
+void *slab_batch_next(slab_batch_t *batch, size_t size);
+
+/* Release an object obtained from slab_alloc() or slab_batch_next() */
+void slab_free(void *obj);
+
+/* Move all chunks and objects of @src into @dst, leaving @src empty */
+void slab_merge(slab_t *dst, slab_t *src);
+
+/* Release every object of @slab at once without visiting them.
+ * Only valid when none of its objects will be referenced again.
+ */
+void slab_purge(slab_t *slab);
+
+/* Tear down @slab.  Chunks which still hold live objects are handed over to
+ * those objects and go away along with the last of them.
+ */
+void slab_destroy(slab_t *slab);
+
+#endif /* LAB0_SLAB_H */
@@ -0,0 +1,288 @@
+#include <stddef.h>
+
+#include "harness.h"
+#include "list.h"
+#include "queue.h"
+#include "timsort.h"
+
+/* Initial number of consecutive wins of one run before switching to
+ * galloping, adapted while merging
+ */
+#define MIN_GALLOP 7
+
+/* Deep enough for any list which fits in memory, as run lengths on the stack
+ * grow at least as fast as the Fibonacci numbers
+ */
+#define MAX_PENDING 64
+
+/**
+ * run_t - Sorted run waiting on the stack to be merged
+ * @list: the run as a null-terminated singly-linked list
+ * @len: number of elements in @list
+ */
+typedef struct {
+    struct list_head *list;
+    size_t len;
+} run_t;
+
+/**
+ * timsort_t - State of a sort
+ * @pending: runs not merged yet, the most recent on top
+ * @n: number of runs in @pending
+ * @min_gallop: wins needed to start galloping
+ * @descend: whether or not to sort in descending order
+ */
+typedef struct {
+    run_t pending[MAX_PENDING];
+    int n;
+    size_t min_gallop;
+    bool descend;
+} timsort_t;
+
+static inline int cmp(const timsort_t *ts,
+                      const struct list_head *a,
+                      const struct list_head *b)
+{
+    int c = q_compare(list_entry(a, element_t, list),
+                      list_entry(b, element_t, list));
+    return ts->descend ? -c : c;
+}
+
+static inline struct list_head *skip(struct list_head *li, size_t n)
+{
+    while (n--)
+        li = li->next;
+    return li;
+}
+
+/* Count the leading elements of @list, @len long, which go before @key: those
+ * not greater than it, or only those less than it if @strict.  Exponential
+ * search followed by a binary search, so it takes O(log k) comparisons for an
+ * answer of k, though still O(k) steps along the list.
+ */
+static size_t gallop(const timsort_t *ts,
+                     struct list_head *list,
+                     size_t len,
+                     const struct list_head *key,
+                     bool strict)
+{
+    /* the first lo elements go before @key, base is the lo-th one */
+    size_t lo = 0, hi = len, step = 1;
+    struct list_head *base = list;
+
+    while (lo < hi) {
+        size_t probe = lo + step - 1 < hi ? lo + step - 1 : hi - 1;
+        struct list_head *li = skip(base, probe - lo);
+        int c = cmp(ts, li, key);
+        if (strict ? c >= 0 : c > 0) {
+            hi = probe;
+            break;
+        }
+        lo = probe + 1;
+        base = li->next;
+        step <<= 1;
+    }
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        struct list_head *li = skip(base, mid - lo);
+        int c = cmp(ts, li, key);
+        if (strict ? c >= 0 : c > 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+            base = li->next;
+        }
+    }
+    return lo;
+}
+
+/* Stable merge of run @b into run @a, which precedes it */
+static void merge_runs(timsort_t *ts, run_t *a, const run_t *b)
+{
+    struct list_head out, *tail = &out;
+    struct list_head *pa = a->list, *pb = b->list;
+    size_t na = a->len, nb = b->len;
+    size_t wins_a = 0, wins_b = 0;
+
+    while (na && nb) {
+        if (wins_a < ts->min_gallop && wins_b < ts->min_gallop) {
+            if (cmp(ts, pa, pb) <= 0) {
+                tail = tail->next = pa;
+                pa = pa->next;
+                na--;
+                wins_a++;
+                wins_b = 0;
+            } else {
+                tail = tail->next = pb;
+                pb = pb->next;
+                nb--;
+                wins_b++;
+                wins_a = 0;
+            }
+            continue;
+        }
+
+        /* One run keeps winning, move whole stretches of each at once */
+        size_t k = gallop(ts, pa, na, pb, false);
+        if (k) {
+            tail->next = pa;
+            tail = skip(pa, k - 1);
+            pa = tail->next;
+            na -= k;
+            if (!na)
+                break;
+        }
+        size_t l = gallop(ts, pb, nb, pa, true);
+        if (l) {
+            tail->next = pb;
+            tail = skip(pb, l - 1);
+            pb = tail->next;
+            nb -= l;
+        }
+
+        if (k < MIN_GALLOP && l < MIN_GALLOP) {
+            /* galloping does not pay off, make it harder to get back */
+            ts->min_gallop++;
+            wins_a = wins_b = 0;
+        } else if (ts->min_gallop > 1) {
+            ts->min_gallop--;
+        }
+    }
+    tail->next = na ? pa : pb;
+
+    a->list = out.next;
+    a->len += b->len;
+}
+
+/* Merge the runs at @i and @i + 1 on the stack */
+static void merge_at(timsort_t *ts, int i)
+{
+    merge_runs(ts, &ts->pending[i], &ts->pending[i + 1]);
+    for (i++; i < ts->n - 1; i++)
+        ts->pending[i] = ts->pending[i + 1];
+    ts->n--;
+}
+
+/* Keep the run lengths on the stack decreasing faster than the Fibonacci
+ * numbers from bottom to top, which balances the merges.  Checks the top
+ * four runs, not three as the original TimSort did, see "OpenJDK's
+ * java.utils.Collection.sort() is broken" by de Gouw et al.
+ */
+static void merge_collapse(timsort_t *ts)
+{
+    run_t *p = ts->pending;
+    while (ts->n > 1) {
+        int i = ts->n - 2;
+        if ((i > 0 && p[i - 1].len <= p[i].len + p[i + 1].len) ||
+            (i > 1 && p[i - 2].len <= p[i - 1].len + p[i].len)) {
+            if (p[i - 1].len < p[i + 1].len)
+                i--;
+        } else if (p[i].len > p[i + 1].len) {
+            break;
+        }
+        merge_at(ts, i);
+    }
+}
+
+/* Cut the next run off the front of *@listp.  A strictly descending run is
+ * reversed in place, which keeps the sort stable as it has no equal
+ * elements.  Runs shorter than @minrun are extended by insertion sort.
+ */
+static run_t next_run(const timsort_t *ts,
+                      struct list_head **listp,
+                      size_t minrun)
+{
+    struct list_head *list = *listp, *tail = list, *next = list->next;
+    size_t len = 1;
+
+    if (next && cmp(ts, list, next) > 0) {
+        while (next && cmp(ts, list, next) > 0) {
+            struct list_head *li = next;
+            next = next->next;
+            li->next = list;
+            list = li;
+            len++;
+        }
+    } else {
+        while (next && cmp(ts, tail, next) <= 0) {
+            tail = next;
+            next = next->next;
+            len++;
+        }
+    }
+    tail->next = NULL;
+
+    for (; len < minrun && next; len++) {
+        struct list_head *li = next;
+        next = next->next;
+        if (cmp(ts, tail, li) <= 0) {
+            tail = tail->next = li;
+            li->next = NULL;
+        } else if (cmp(ts, list, li) > 0) {
+            li->next = list;
+            list = li;
+        } else {
+            /* after every element not greater than it, for stability */
+            struct list_head *pos = list;
+            while (cmp(ts, pos->next, li) <= 0)
+                pos = pos->next;
+            li->next = pos->next;
+            pos->next = li;
+        }
+    }
+
+    *listp = next;
+    return (run_t){.list = list, .len = len};
+}
+
+/* Pick a minimum run length in [32, 64] such that @n / minrun is a power of
+ * two or a little less than one, which keeps the final merges balanced
+ */
+static size_t compute_minrun(size_t n)
+{
+    size_t r = 0;
+    while (n >= 64) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+void tim_sort(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
+
+    timsort_t ts = {.n = 0, .min_gallop = MIN_GALLOP, .descend = descend};
+    size_t n = 0;
+    struct list_head *li;
+    list_for_each (li, head)
+        n++;
+    size_t minrun = compute_minrun(n);
+
+    /* Convert to a null-terminated singly-linked list. */
+    struct list_head *list = head->next;
+    head->prev->next = NULL;
+
+    while (list) {
+        ts.pending[ts.n++] = next_run(&ts, &list, minrun);
+        merge_collapse(&ts);
+    }
+    while (ts.n > 1) {
+        int i = ts.n - 2;
+        if (i > 0 && ts.pending[i - 1].len < ts.pending[i + 1].len)
+            i--;
+        merge_at(&ts, i);
+    }
+
+    /* Restore the prev links and close the circle */
+    struct list_head *prev = head;
+    for (list = ts.pending[0].list; list; list = list->next) {
+        prev->next = list;
+        list->prev = prev;
+        prev = list;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
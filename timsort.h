@@ -0,0 +1,6 @@
+#ifndef LAB0_TIMSORT_H
+#define LAB0_TIMSORT_H
+
+void tim_sort(struct list_head *head, bool descend);
+
+#endif /* LAB0_TIMSORT_H */
@@ -0,0 +1,30 @@
+# Test of toggling string interning while queues hold elements
+option fail 0
+option malloc 0
+new
+option intern 1
+ih gerbil 3
+it dolphin
+option intern 0
+ph gerbil
+pt dolphin
+ih gerbil
+it dolphin 2
+rh gerbil
+rt dolphin
+option intern 1
+it jaguar 2000
+option intern 0
+ih jaguar 2000
+sort
+new
+it jaguar 10
+option intern 1
+it jaguar 10
+sort
+merge
+option intern 0
+dedup
+rh dolphin
+free
+quit
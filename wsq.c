@@ -0,0 +1,162 @@
+/* The buffers come from the system allocator: the harness keeps its books
+ * without any locking, so it must not be entered from several threads.
+ */
+#define INTERNAL 1
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "wsq.h"
+
+/* Initial capacity of a deque, a power of two */
+#define WSQ_INIT_SIZE 64
+
+#define WSQ_CACHE_LINE 64
+
+/**
+ * wsq_array_t - Circular buffer of a deque
+ * @mask: capacity minus one, the capacity being a power of two
+ * @prev: the buffer this one replaced when growing
+ * @buf: the elements, indexed by position modulo the capacity
+ *
+ * A thief may still read from a buffer after the owner replaced it, so the
+ * old buffers are kept until the deque goes away.
+ */
+typedef struct wsq_array {
+    size_t mask;
+    struct wsq_array *prev;
+    _Atomic(element_t *) buf[];
+} wsq_array_t;
+
+/**
+ * struct wsq - Work-stealing deque
+ * @top: position of the next element to steal
+ * @bottom: position of the next element to push
+ * @array: the current buffer
+ */
+struct wsq {
+    _Alignas(WSQ_CACHE_LINE) _Atomic(int64_t) top;
+    _Alignas(WSQ_CACHE_LINE) _Atomic(int64_t) bottom;
+    _Atomic(wsq_array_t *) array;
+};
+
+static wsq_array_t *wsq_array_new(size_t size)
+{
+    wsq_array_t *a = malloc(sizeof(wsq_array_t) + size * sizeof(a->buf[0]));
+    if (!a)
+        return NULL;
+    a->mask = size - 1;
+    a->prev = NULL;
+    return a;
+}
+
+wsq_t *wsq_new(void)
+{
+    wsq_t *q = aligned_alloc(WSQ_CACHE_LINE, sizeof(wsq_t));
+    if (!q)
+        return NULL;
+    wsq_array_t *a = wsq_array_new(WSQ_INIT_SIZE);
+    if (!a) {
+        free(q);
+        return NULL;
+    }
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, a);
+    return q;
+}
+
+void wsq_free(wsq_t *q)
+{
+    if (!q)
+        return;
+
+    wsq_array_t *a = atomic_load(&q->array);
+    while (a) {
+        wsq_array_t *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    free(q);
+}
+
+/* Double the capacity of @a holding the elements from @t up to @b */
+static wsq_array_t *wsq_grow(wsq_array_t *a, int64_t t, int64_t b)
+{
+    wsq_array_t *na = wsq_array_new(2 * (a->mask + 1));
+    if (!na)
+        return NULL;
+    for (int64_t i = t; i < b; i++) {
+        element_t *e = atomic_load_explicit(&a->buf[i & a->mask],
+                                            memory_order_relaxed);
+        atomic_store_explicit(&na->buf[i & na->mask], e, memory_order_relaxed);
+    }
+    na->prev = a;
+    return na;
+}
+
+bool wsq_push(wsq_t *q, element_t *e)
+{
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    wsq_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+
+    if (b - t > (int64_t) a->mask) {
+        if (!(a = wsq_grow(a, t, b)))
+            return false;
+        atomic_store_explicit(&q->array, a, memory_order_release);
+    }
+    atomic_store_explicit(&a->buf[b & a->mask], e, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+element_t *wsq_pop(wsq_t *q)
+{
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    wsq_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    if (t > b) {
+        /* empty */
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    element_t *e = atomic_load_explicit(&a->buf[b & a->mask],
+                                        memory_order_relaxed);
+    if (t == b) {
+        /* the last element, race the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            e = NULL;
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+    return e;
+}
+
+element_t *wsq_steal(wsq_t *q)
+{
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+    if (t >= b)
+        return NULL;
+
+    wsq_array_t *a = atomic_load_explicit(&q->array, memory_order_acquire);
+    element_t *e = atomic_load_explicit(&a->buf[t & a->mask],
+                                        memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+    return e;
+}
@@ -0,0 +1,38 @@
+#ifndef LAB0_WSQ_H
+#define LAB0_WSQ_H
+
+/* Work-stealing deque of queue elements.
+ *
+ * It is the deque of Chase and Lev, "Dynamic Circular Work-Stealing Deque",
+ * with the memory orderings of Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models".  The owner thread pushes and pops at
+ * the bottom end, like a stack, while any other thread may steal from the
+ * top end.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+typedef struct wsq wsq_t;
+
+/* Create an empty deque, NULL for allocation failed */
+wsq_t *wsq_new(void);
+
+/* Release @q, though not the elements still in it.  No other thread may
+ * operate on @q any more.
+ */
+void wsq_free(wsq_t *q);
+
+/* Push @e at the bottom of @q, false for allocation failed.  Owner only. */
+bool wsq_push(wsq_t *q, element_t *e);
+
+/* Pop the element at the bottom of @q, NULL if @q is empty.  Owner only. */
+element_t *wsq_pop(wsq_t *q);
+
+/* Steal the element at the top of @q, NULL if @q is empty or another thread
+ * got it first
+ */
+element_t *wsq_steal(wsq_t *q);
+
+#endif /* LAB0_WSQ_H */